@@ -13,8 +13,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include <set>
+#include <algorithm>
 #include <string>
 
 #include <epicsEvent.h>
@@ -24,7 +26,10 @@
 #include <iocsh.h>
 #include <cantProceed.h>
 #include <epicsString.h>
+#include <epicsStdio.h>
 #include <epicsExit.h>
+#include <epicsAtomic.h>
+#include <initHooks.h>
 
 #ifdef _WIN32
 #include "CircularInterface.h"
@@ -46,6 +51,13 @@ using namespace std;
 
 #include <epicsExport.h>
 #include "BFFeature.h"
+#include "BFTrace.h"
+#include "BFSystem.h"
+#include "BFClockModel.h"
+#include "BFLatency.h"
+#include "BFPreview.h"
+#include "BFFeatureMap.h"
+#include "BFDeviceEvents.h"
 #include "ADBitFlow.h"
 
 #define DRIVER_VERSION      1
@@ -64,6 +76,22 @@ typedef enum {
     UniqueIdDriver
 } BFUniqueId_t;
 
+typedef enum {
+    ProcessingWorkers,
+    ProcessingInline
+} BFProcessingMode_t;
+
+typedef enum {
+    MemoryRefuse,
+    MemoryDownsize
+} BFMemoryPolicy_t;
+
+typedef enum {
+    WaitBlocking,
+    WaitBusyPoll,
+    WaitHybrid
+} BFWaitStrategy_t;
+
 /** Configuration function to configure one camera.
  *
  * This function need to be called once for each camera to be used by the IOC. A call to this
@@ -76,22 +104,51 @@ typedef enum {
  * \param[in] maxMemory Maximum memory (in bytes) that this driver is allowed to allocate. 0=unlimited.
  * \param[in] priority The EPICS thread priority for this driver.  0=use asyn default.
  * \param[in] stackSize The size of the stack for the EPICS port thread. 0=use asyn default.
+ * \param[in] waitThreadCPUs CPUs the thread waiting for frames may run on, e.g. "2" or "2-3". NULL or ""=no restriction.
+ * \param[in] workerThreadCPUs CPUs for the image processing threads, e.g. "4-7".  Each thread is pinned
+ *            to one CPU from the list in turn. NULL or ""=no restriction.
+ * \param[in] realTimePriority If >0 the wait thread uses SCHED_FIFO with this priority and the image
+ *            processing threads use SCHED_FIFO with this priority-1. 0=use the EPICS thread priorities.
  */
 extern "C" int ADBitFlowConfig(const char *portName, int boardNum, int numBFBuffers, int numThreads,
-                               size_t maxMemory, int priority, int stackSize)
+                               size_t maxMemory, int priority, int stackSize,
+                               const char *waitThreadCPUs, const char *workerThreadCPUs, int realTimePriority)
 {
-    new ADBitFlow(portName, boardNum, numBFBuffers, numThreads, maxMemory, priority, stackSize);
+    new ADBitFlow(portName, boardNum, numBFBuffers, numThreads, maxMemory, priority, stackSize,
+                  waitThreadCPUs, workerThreadCPUs, realTimePriority);
     return asynSuccess;
 }
 
+// Maximum number of frames the wait thread hands to the workers with one lock acquisition
+static const int maxFrameBatch = 32;
+// How often the wait thread checks for a stall when the watchdog is enabled
+static const int watchdogPeriodMs = 100;
+// uniqueId of the message that asks a worker thread to exit
+static const int workerExitId = -1;
+// Upper limit on the number of worker threads
+static const int maxWorkerThreads = 64;
+// The worker pool grows above this utilization and shrinks below the low one
+static const double workerHighUtilization = 0.8;
+static const double workerLowUtilization = 0.3;
+// Number of status intervals the utilization must stay low before a worker is removed
+static const int workerIdleIntervals = 10;
+// How often statusThread computes the percentiles and the other statistics, in seconds
+static const double statisticsPeriod = 1.0;
+// Number of times restoreConfig retries the writes that the camera rejected
+static const int maxRestorePasses = 3;
+// Bound on the memory of the preview port's NDArrays, 4 full 8 Mpixel 16-bit frames
+static const size_t previewMaxMemory = 64*1024*1024;
+
 struct workerQueueElement {
     #ifdef _WIN32
       BiCirHandle cirHandle;
     #else
       tCIU32 frameID;
       tCIU8 *pFrame;
+      tCIextraFrameInfo extraInfo;
     #endif
     int uniqueId;
+    epicsTimeStamp arrivalTime;
 };
 
 static void c_shutdown(void *arg)
@@ -114,31 +171,104 @@ static void processImageThreadC(void *drvPvt)
     pPvt->processImageThread();
 }
 
+static void statusThreadC(void *drvPvt)
+{
+    ADBitFlow *pPvt = (ADBitFlow *)drvPvt;
+
+    pPvt->statusThread();
+}
+
+static void controlThreadC(void *drvPvt)
+{
+    ADBitFlow *pPvt = (ADBitFlow *)drvPvt;
+
+    pPvt->controlThread();
+}
+
+static void pollThreadC(void *drvPvt)
+{
+    ADBitFlow *pPvt = (ADBitFlow *)drvPvt;
+
+    pPvt->pollThread();
+}
+
+static void previewThreadC(void *drvPvt)
+{
+    ADBitFlow *pPvt = (ADBitFlow *)drvPvt;
+
+    pPvt->previewThread();
+}
+
+static void resolveFeaturesThreadC(void *drvPvt)
+{
+    ADBitFlow *pPvt = (ADBitFlow *)drvPvt;
+
+    pPvt->resolveFeaturesThread();
+}
+
+// Drivers that are told when the IOC is running
+static std::vector<ADBitFlow *> bitFlowDrivers;
+
+static void bitFlowInitHook(initHookState state)
+{
+    if (state != initHookAfterIocRunning) return;
+    for (size_t i=0; i<bitFlowDrivers.size(); i++) {
+        bitFlowDrivers[i]->iocRunning();
+    }
+}
+
 
 /** Constructor for the ADBitFlow class
  * \param[in] portName asyn port name to assign to the camera.
  * \param[in] boardNum The board number.  Default is 0.
  * \param[in] numBFBuffers The number of buffers to allocate in BitFlow driver.
  *            If set to 0 or omitted the default of 100 will be used.
- * \param(in) numThreads Number of image processing threads.  If set to 0 or omitted 2 will be used.
+ * \param(in) numThreads Initial number of image processing threads.  If set to 0 or omitted 2 will be used.
+ *            The pool stays at this size unless BFMinWorkers and BFMaxWorkers are changed.
  * \param[in] maxMemory Maximum memory (in bytes) that this driver is allowed to allocate. 0=unlimited.
  * \param[in] priority The EPICS thread priority for this driver.  0=use asyn default.
  * \param[in] stackSize The size of the stack for the EPICS port thread. 0=use asyn default.
+ * \param[in] waitThreadCPUs CPUs the thread waiting for frames may run on, e.g. "2" or "2-3". NULL or ""=no restriction.
+ * \param[in] workerThreadCPUs CPUs for the image processing threads, e.g. "4-7".  Each thread is pinned
+ *            to one CPU from the list in turn. NULL or ""=no restriction.
+ * \param[in] realTimePriority If >0 the wait thread uses SCHED_FIFO with this priority and the image
+ *            processing threads use SCHED_FIFO with this priority-1. 0=use the EPICS thread priorities.
  */
 ADBitFlow::ADBitFlow(const char *portName, int boardNum, int numBFBuffers, int numThreads,
-                         size_t maxMemory, int priority, int stackSize )
+                         size_t maxMemory, int priority, int stackSize,
+                         const char *waitThreadCPUs, const char *workerThreadCPUs, int realTimePriority)
     : ADGenICam(portName, maxMemory, priority, stackSize),
-    boardNum_(boardNum), hBoard_(0), pBoard_(0), hDevice_(0), numBFBuffers_(numBFBuffers), exiting_(0), uniqueId_(0)
+    boardNum_(boardNum), hBoard_(0), pBoard_(0), hDevice_(0), pFeatureCache_(new BFFeatureCache()), pFeatureMap_(new BFFeatureMap()),
+    pControlStats_(new BFControlStats()), controlTransactions_(0),
+    nodesResolved_(0), nodeResolveTime_(0.), featureMapMismatches_(0), featureEvents_(0), pDeviceEvents_(0),
+    iocInitTime_(0.), startupTime_(0.), numBFBuffers_(numBFBuffers), maxMemory_(maxMemory), bufferBytes_(0.), exiting_(0),
+    writeBusy_(false), writesCoalesced_(0), pWriteLatency_(0), uniqueId_(0),
+    arrayCounter_(0), numImagesCounter_(0), bufferQueueSize_(0), processTotalTime_(0.), processCopyTime_(0.), pTracer_(0),
+    realTimePriority_(realTimePriority), numWorkers_(0), workerBusyTime_(0.), idleIntervals_(0), workersRunning_(0), resizing_(false), pPreview_(0), pPreviewArray_(0),
+    numaNode_(-1), acquiring_(0), stopping_(false), waitStrategy_(WaitBlocking), frameInterval_(0.), stalled_(false), recovering_(false), framesInFlight_(0)
 {
     static const char *functionName = "ADBitFlow";
     asynStatus status;
     
+    epicsTimeGetCurrent(&createTime_);
     //pasynTrace->setTraceMask(pasynUserSelf, ASYN_TRACE_ERROR | ASYN_TRACE_WARNING | ASYN_TRACEIO_DRIVER);
     
     if (numBFBuffers_ == 0) numBFBuffers_ = 100;
     if (numBFBuffers_ < 10) numBFBuffers_ = 10;
-    messageQueueSize_ = numBFBuffers;
+    messageQueueSize_ = numBFBuffers_;
     if (numThreads <= 0) numThreads = 2;
+    if (numThreads > maxWorkerThreads) numThreads = maxWorkerThreads;
+    if (parseCPUList(waitThreadCPUs, waitThreadCPUs_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: invalid waitThreadCPUs=%s, not setting affinity\n",
+            driverName, functionName, waitThreadCPUs);
+    }
+    if (parseCPUList(workerThreadCPUs, workerThreadCPUs_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: invalid workerThreadCPUs=%s, not setting affinity\n",
+            driverName, functionName, workerThreadCPUs);
+    }
+    workerCPUUse_.assign(workerThreadCPUs_.size(), 0);
 
     status = connectCamera();
     if (status) {
@@ -158,12 +288,170 @@ ADBitFlow::ADBitFlow(const char *portName, int boardNum, int numBFBuffers, int n
     createParam(BFMessageQueueFreeString,           asynParamInt32,   &BFMessageQueueFree);
     createParam(BFProcessTotalTimeString,         asynParamFloat64,   &BFProcessTotalTime);
     createParam(BFProcessCopyTimeString,          asynParamFloat64,   &BFProcessCopyTime);
+    createParam(BFStatusUpdateRateString,         asynParamFloat64,   &BFStatusUpdateRate);
+    createParam(BFNUMANodeString,                   asynParamInt32,   &BFNUMANode);
+    createParam(BFPreallocArraysString,             asynParamInt32,   &BFPreallocArrays);
+    createParam(BFHugePagesString,                  asynParamInt32,   &BFHugePages);
+    createParam(BFLockMemoryString,                 asynParamInt32,   &BFLockMemory);
+    createParam(BFHugePageMemoryString,           asynParamFloat64,   &BFHugePageMemory);
+    createParam(BFClockSyncString,                  asynParamInt32,   &BFClockSync);
+    createParam(BFClockWindowString,                asynParamInt32,   &BFClockWindow);
+    createParam(BFClockSamplesString,               asynParamInt32,   &BFClockSamples);
+    createParam(BFClockFrequencyString,           asynParamFloat64,   &BFClockFrequency);
+    createParam(BFClockResidualString,            asynParamFloat64,   &BFClockResidual);
+    createParam(BFProcessingModeString,             asynParamInt32,   &BFProcessingMode);
+    createParam(BFLatencyP50String,               asynParamFloat64,   &BFLatencyP50);
+    createParam(BFLatencyP99String,               asynParamFloat64,   &BFLatencyP99);
+    createParam(BFLatencyMaxString,               asynParamFloat64,   &BFLatencyMax);
+    createParam(BFWaitStrategyString,               asynParamInt32,   &BFWaitStrategy);
+    createParam(BFWaitSpinTimeString,             asynParamFloat64,   &BFWaitSpinTime);
+    createParam(BFArrivalJitterBlockingP50String,  asynParamFloat64,   &BFArrivalJitterBlockingP50);
+    createParam(BFArrivalJitterBlockingP99String,  asynParamFloat64,   &BFArrivalJitterBlockingP99);
+    createParam(BFArrivalJitterBusyPollP50String,  asynParamFloat64,   &BFArrivalJitterBusyPollP50);
+    createParam(BFArrivalJitterBusyPollP99String,  asynParamFloat64,   &BFArrivalJitterBusyPollP99);
+    createParam(BFArrivalJitterHybridP50String,    asynParamFloat64,   &BFArrivalJitterHybridP50);
+    createParam(BFArrivalJitterHybridP99String,    asynParamFloat64,   &BFArrivalJitterHybridP99);
+    createParam(BFStallTimeoutString,             asynParamFloat64,   &BFStallTimeout);
+    createParam(BFStallFactorString,              asynParamFloat64,   &BFStallFactor);
+    createParam(BFStallRecoveryString,              asynParamInt32,   &BFStallRecovery);
+    createParam(BFStalledString,                    asynParamInt32,   &BFStalled);
+    createParam(BFRecoveriesString,                 asynParamInt32,   &BFRecoveries);
+    createParam(BFFrameIntervalString,            asynParamFloat64,   &BFFrameInterval);
+    createParam(BFMinWorkersString,                 asynParamInt32,   &BFMinWorkers);
+    createParam(BFMaxWorkersString,                 asynParamInt32,   &BFMaxWorkers);
+    createParam(BFNumWorkersString,                 asynParamInt32,   &BFNumWorkers);
+    createParam(BFWorkerUtilizationString,        asynParamFloat64,   &BFWorkerUtilization);
+    createParam(BFBufferBytesString,              asynParamFloat64,   &BFBufferBytes);
+    createParam(BFMemoryBudgetString,             asynParamFloat64,   &BFMemoryBudget);
+    createParam(BFMemoryPolicyString,               asynParamInt32,   &BFMemoryPolicy);
+    createParam(BFMemoryRingString,               asynParamFloat64,   &BFMemoryRing);
+    createParam(BFMemorySlabString,               asynParamFloat64,   &BFMemorySlab);
+    createParam(BFMemoryQueueString,              asynParamFloat64,   &BFMemoryQueue);
+    createParam(BFMemoryPreviewString,            asynParamFloat64,   &BFMemoryPreview);
+    createParam(BFMemoryTotalString,              asynParamFloat64,   &BFMemoryTotal);
+    createParam(BFMemoryPoolString,               asynParamFloat64,   &BFMemoryPool);
+    createParam(BFPreviewEnableString,              asynParamInt32,   &BFPreviewEnable);
+    createParam(BFPreviewRateString,              asynParamFloat64,   &BFPreviewRate);
+    createParam(BFPreviewBinningString,             asynParamInt32,   &BFPreviewBinning);
+    createParam(BFPreview8BitString,                asynParamInt32,   &BFPreview8Bit);
+    createParam(BFPreviewShiftString,               asynParamInt32,   &BFPreviewShift);
+    createParam(BFPreviewCounterString,             asynParamInt32,   &BFPreviewCounter);
+    createParam(BFFeatureCacheAgeString,          asynParamFloat64,   &BFFeatureCacheAge);
+    createParam(BFFeatureCacheHitsString,           asynParamInt32,   &BFFeatureCacheHits);
+    createParam(BFFeatureCacheMissesString,         asynParamInt32,   &BFFeatureCacheMisses);
+    createParam(BFIocInitTimeString,              asynParamFloat64,   &BFIocInitTime);
+    createParam(BFStartupTimeString,              asynParamFloat64,   &BFStartupTime);
+    createParam(BFNodesResolvedString,              asynParamInt32,   &BFNodesResolved);
+    createParam(BFNodeResolveTimeString,          asynParamFloat64,   &BFNodeResolveTime);
+    createParam(BFPollEnableString,                 asynParamInt32,   &BFPollEnable);
+    createParam(BFPollFastPeriodString,           asynParamFloat64,   &BFPollFastPeriod);
+    createParam(BFPollSlowPeriodString,           asynParamFloat64,   &BFPollSlowPeriod);
+    createParam(BFPollCountString,                  asynParamInt32,   &BFPollCount);
+    createParam(BFPollTimeString,                 asynParamFloat64,   &BFPollTime);
+    createParam(BFAsyncWritesString,                asynParamInt32,   &BFAsyncWrites);
+    createParam(BFWritesPendingString,              asynParamInt32,   &BFWritesPending);
+    createParam(BFWritesCoalescedString,            asynParamInt32,   &BFWritesCoalesced);
+    createParam(BFWriteLatencyP50String,          asynParamFloat64,   &BFWriteLatencyP50);
+    createParam(BFWriteLatencyP99String,          asynParamFloat64,   &BFWriteLatencyP99);
+    createParam(BFWriteLatencyMaxString,          asynParamFloat64,   &BFWriteLatencyMax);
+    createParam(BFFeatureMapNodesString,            asynParamInt32,   &BFFeatureMapNodes);
+    createParam(BFFeatureMapMismatchesString,       asynParamInt32,   &BFFeatureMapMismatches);
+    createParam(BFConfigFileString,                 asynParamOctet,   &BFConfigFile);
+    createParam(BFConfigSaveString,                 asynParamInt32,   &BFConfigSave);
+    createParam(BFConfigRestoreString,              asynParamInt32,   &BFConfigRestore);
+    createParam(BFConfigFeaturesString,             asynParamInt32,   &BFConfigFeatures);
+    createParam(BFConfigWrittenString,              asynParamInt32,   &BFConfigWritten);
+    createParam(BFConfigFailedString,               asynParamInt32,   &BFConfigFailed);
+    createParam(BFConfigRestoreTimeString,          asynParamFloat64, &BFConfigRestoreTime);
+    createParam(BFControlReadsString,               asynParamInt32,   &BFControlReads);
+    createParam(BFControlWritesString,              asynParamInt32,   &BFControlWrites);
+    createParam(BFControlRateString,                asynParamFloat64, &BFControlRate);
+    createParam(BFControlTimeString,                asynParamFloat64, &BFControlTime);
+    createParam(BFControlReadP99String,             asynParamFloat64, &BFControlReadP99);
+    createParam(BFControlWriteP99String,            asynParamFloat64, &BFControlWriteP99);
+    createParam(BFControlTopString,                 asynParamOctet,   &BFControlTop);
+    createParam(BFControlResetString,               asynParamInt32,   &BFControlReset);
+    createParam(BFFeatureEventsString,              asynParamInt32,   &BFFeatureEvents);
 
     /* Set initial values of some parameters */
-    setIntegerParam(BFBufferSize, numBFBuffers);
+    setIntegerParam(BFBufferSize, numBFBuffers_);
+    setDoubleParam(BFBufferBytes, 0.);
+    setDoubleParam(BFMemoryBudget, 0.);
+    setIntegerParam(BFMemoryPolicy, MemoryRefuse);
+    setIntegerParam(BFPreviewEnable, 0);
+    setDoubleParam(BFPreviewRate, 10.);
+    setIntegerParam(BFPreviewBinning, 1);
+    setIntegerParam(BFPreview8Bit, 0);
+    setIntegerParam(BFPreviewShift, -1);
+    setIntegerParam(BFPreviewCounter, 0);
+    setDoubleParam(BFFeatureCacheAge, 1.0);
+    pFeatureCache_->setMaxAge(1.0);
+    setIntegerParam(BFFeatureCacheHits, 0);
+    setIntegerParam(BFFeatureCacheMisses, 0);
+    setDoubleParam(BFIocInitTime, 0.);
+    setDoubleParam(BFStartupTime, 0.);
+    setIntegerParam(BFNodesResolved, 0);
+    setDoubleParam(BFNodeResolveTime, 0.);
+    setIntegerParam(BFPollEnable, 0);
+    setDoubleParam(BFPollFastPeriod, 1.0);
+    setDoubleParam(BFPollSlowPeriod, 10.0);
+    setIntegerParam(BFPollCount, 0);
+    setDoubleParam(BFPollTime, 0.);
+    setIntegerParam(BFAsyncWrites, 0);
+    setIntegerParam(BFWritesPending, 0);
+    setIntegerParam(BFWritesCoalesced, 0);
+    pWriteLatency_ = new BFLatencyStats(1024);
+    setIntegerParam(BFFeatureMapNodes, 0);
+    setIntegerParam(BFFeatureMapMismatches, 0);
+    setStringParam(BFConfigFile, "");
+    setIntegerParam(BFConfigSave, 0);
+    setIntegerParam(BFConfigRestore, 0);
+    setIntegerParam(BFConfigFeatures, 0);
+    setIntegerParam(BFConfigWritten, 0);
+    setIntegerParam(BFConfigFailed, 0);
+    setDoubleParam(BFConfigRestoreTime, 0.);
+    setIntegerParam(BFControlReads, 0);
+    setIntegerParam(BFControlWrites, 0);
+    setDoubleParam(BFControlRate, 0.);
+    setDoubleParam(BFControlTime, 0.);
+    setDoubleParam(BFControlReadP99, 0.);
+    setDoubleParam(BFControlWriteP99, 0.);
+    setStringParam(BFControlTop, "");
+    setIntegerParam(BFFeatureEvents, 0);
+    epicsTimeGetCurrent(&controlRateTime_);
+    epicsTimeGetCurrent(&statisticsTime_);
+    epicsTimeGetCurrent(&lastPreviewTime_);
+    std::string previewPortName = std::string(portName) + "_PREVIEW";
+    pPreview_ = new BFPreview(previewPortName.c_str(), previewMaxMemory);
     setIntegerParam(BFBufferQueueSize, 0);
     setIntegerParam(BFMessageQueueSize, messageQueueSize_);
     setIntegerParam(BFMessageQueueFree, messageQueueSize_);
+    setDoubleParam(BFStatusUpdateRate, 10.);
+    setIntegerParam(BFNUMANode, numaNode_);
+    setIntegerParam(BFPreallocArrays, 0);
+    setIntegerParam(BFHugePages, 0);
+    setIntegerParam(BFLockMemory, 0);
+    setDoubleParam(BFHugePageMemory, getHugePageMemory());
+    setIntegerParam(BFClockSync, 0);
+    setIntegerParam(BFClockWindow, 256);
+    pClockModel_ = new BFClockModel(256);
+    setIntegerParam(BFProcessingMode, ProcessingWorkers);
+    pLatencyStats_ = new BFLatencyStats(1024);
+    setIntegerParam(BFWaitStrategy, WaitBlocking);
+    setDoubleParam(BFWaitSpinTime, 100.);
+    pJitterModel_ = new BFClockModel(256);
+    for (int i=0; i<3; i++) {
+        pArrivalJitter_[i] = new BFLatencyStats(1024);
+    }
+    setDoubleParam(BFStallTimeout, 0.);
+    setDoubleParam(BFStallFactor, 10.);
+    setIntegerParam(BFStallRecovery, 0);
+    setIntegerParam(BFStalled, 0);
+    setIntegerParam(BFRecoveries, 0);
+    setDoubleParam(BFFrameInterval, 0.);
+    setIntegerParam(BFMinWorkers, numThreads);
+    setIntegerParam(BFMaxWorkers, numThreads);
+    setDoubleParam(BFWorkerUtilization, 0.);
     setIntegerParam(NDDataType, NDUInt8);
     setIntegerParam(NDColorMode, NDColorModeMono);
     setIntegerParam(NDArraySizeZ, 0);
@@ -179,7 +467,16 @@ ADBitFlow::ADBitFlow(const char *portName, int boardNum, int numBFBuffers, int n
         cantProceed("ADBitFlow::ADBitFlow epicsMessageQueueCreate failure\n");
     }
 
+#ifdef BF_FRAME_TRACE
+    pTracer_ = new BFTracer(16384);
+#endif
     startEventId_ = epicsEventCreate(epicsEventEmpty);
+    statusEventId_ = epicsEventCreate(epicsEventEmpty);
+    pollEventId_ = epicsEventCreate(epicsEventEmpty);
+    writeEventId_ = epicsEventCreate(epicsEventEmpty);
+    writeDoneEventId_ = epicsEventCreate(epicsEventEmpty);
+    stopDoneEventId_ = epicsEventCreate(epicsEventEmpty);
+    previewEventId_ = epicsEventCreate(epicsEventEmpty);
 
     // Launch the thread that waits for images
     epicsThreadCreate("ADBFWaitImageThread", 
@@ -190,11 +487,37 @@ ADBitFlow::ADBitFlow(const char *portName, int boardNum, int numBFBuffers, int n
 
     // Launch the threads that process images
     for (int i=0; i<numThreads; i++) {
-        epicsThreadCreate("ADBFProcessImageThread", 
-                          epicsThreadPriorityMedium,
-                          epicsThreadGetStackSize(epicsThreadStackMedium),
-                          processImageThreadC, this);
+        startWorker();
     }
+    setIntegerParam(BFNumWorkers, numWorkers_);
+    epicsTimeGetCurrent(&lastAdjustTime_);
+
+    // Launch the thread that publishes the counters and timing at BFStatusUpdateRate
+    epicsThreadCreate("ADBFStatusThread", 
+                      epicsThreadPriorityLow,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      statusThreadC, this);
+
+    // Launch the thread that executes the queued feature writes
+    epicsThreadCreate("ADBFControlThread", 
+                      epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      controlThreadC, this);
+
+    // Launch the thread that polls the GenICam features
+    epicsThreadCreate("ADBFPollThread", 
+                      epicsThreadPriorityLow,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      pollThreadC, this);
+
+    // Launch the thread that bins the preview frames
+    epicsThreadCreate("ADBFPreviewThread", 
+                      epicsThreadPriorityLow,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      previewThreadC, this);
+
+    // iocRunning() starts the thread that opens the GenICam nodes not yet used by the records
+    bitFlowDrivers.push_back(this);
 
     // shutdown on exit
     epicsAtExit(c_shutdown, this);
@@ -206,13 +529,457 @@ BFGTLDev ADBitFlow::getBFGTLDev() {
     return hDevice_;
 }
 
+BFFeatureCache *ADBitFlow::getFeatureCache() {
+    return pFeatureCache_;
+}
+
+BFFeatureMap *ADBitFlow::getFeatureMap() {
+    return pFeatureMap_;
+}
+
+BFControlStats *ADBitFlow::getControlStats() {
+    return pControlStats_;
+}
+
+static bool compareControlTime(BFFeature *a, BFFeature *b)
+{
+    BFNodeStats & sa = a->getNodeStats();
+    BFNodeStats & sb = b->getNodeStats();
+    return (sa.readTime + sa.writeTime) > (sb.readTime + sb.writeTime);
+}
+
+/** Returns the count features that spent the most time on the control channel, most expensive first.
+  * Called with the lock held.
+  */
+void ADBitFlow::topFeatures(size_t count, std::vector<BFFeature *> & top)
+{
+    top.clear();
+    pControlStats_->lock();
+    for (size_t i=0; i<features_.size(); i++) {
+        BFNodeStats & stats = features_[i]->getNodeStats();
+        if (stats.reads + stats.writes) top.push_back(features_[i]);
+    }
+    if (count > top.size()) count = top.size();
+    std::partial_sort(top.begin(), top.begin() + count, top.end(), compareControlTime);
+    top.resize(count);
+    pControlStats_->unlock();
+}
+
+/** Reads a string node directly, used before the features have been created.
+  * \return The value, or an empty string if the node cannot be read.
+  */
+std::string ADBitFlow::readNodeString(const char *nodeName)
+{
+    BFGTLNode hNode;
+    char value[256];
+    size_t size = sizeof(value);
+
+    if (!BFGTLDevNodeExists(hDevice_, nodeName)) return "";
+    if (BFGTLNodeOpen(hDevice_, nodeName, &hNode)) return "";
+    if (BFGTLNodeRead(hNode, BFGTL_NODE_VALUE, value, &size)) {
+        BFGTLNodeClose(hNode);
+        return "";
+    }
+    BFGTLNodeClose(hNode);
+    value[sizeof(value)-1] = 0;
+    return value;
+}
+
+/** Enables the feature map, which saves the node metadata discovered by the features to a file in
+  * directory and loads it at the next start.  The file is named after the camera model, the firmware
+  * version and the SDK version, so a different camera or an upgrade starts a new map.
+  * If any of these cannot be read the map stays disabled, because cameras that share the key would
+  * load each other's map.
+  * Must be called before iocInit.
+  */
+asynStatus ADBitFlow::loadFeatureMap(const char *directory)
+{
+    static const char *functionName = "loadFeatureMap";
+
+    lock();
+    std::string model = readNodeString("DeviceModelName");
+    std::string firmware = readNodeString("DeviceFirmwareVersion");
+    if (model.empty() || firmware.empty() || sdkVersion_.empty()) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s the camera model or firmware version cannot be read, the feature map is not used\n",
+            driverName, functionName);
+        unlock();
+        return asynError;
+    }
+    std::string key = model + "|" + firmware + "|" + sdkVersion_;
+    std::string fileName = key;
+    for (size_t i=0; i<fileName.size(); i++) {
+        if (!isalnum((unsigned char)fileName[i]) && (fileName[i] != '.') && (fileName[i] != '-')) fileName[i] = '_';
+    }
+    fileName = std::string(directory) + "/ADBitFlow_" + fileName + ".map";
+    int numNodes = pFeatureMap_->load(fileName, key);
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s loaded %d nodes from %s\n",
+        driverName, functionName, numNodes, fileName.c_str());
+    setIntegerParam(BFFeatureMapNodes, numNodes);
+    callParamCallbacks();
+    unlock();
+    return asynSuccess;
+}
+
+/** Writes the feature map if nodes were discovered or corrected since it was loaded.  Called with the lock held. */
+void ADBitFlow::saveFeatureMap()
+{
+    static const char *functionName = "saveFeatureMap";
+
+    if (!pFeatureMap_->isDirty()) return;
+    if (pFeatureMap_->save()) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error writing %s\n",
+            driverName, functionName, pFeatureMap_->getFileName().c_str());
+    }
+}
+
+/** Writes the current value of every writable feature to fileName, see BFFeature::snapshot for the format.
+  * Called with the lock held.
+  */
+asynStatus ADBitFlow::saveConfig(const char *fileName)
+{
+    std::set<std::string> saved;
+    std::string line;
+    static const char *functionName = "saveConfig";
+
+    FILE *fp = fopen(fileName, "w");
+    if (!fp) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot open %s\n",
+            driverName, functionName, fileName);
+        return asynError;
+    }
+    for (size_t i=0; i<features_.size(); i++) {
+        // Several parameters can be attached to the same feature
+        if (saved.count(features_[i]->getFeatureName())) continue;
+        if (!features_[i]->snapshot(line)) continue;
+        saved.insert(features_[i]->getFeatureName());
+        fprintf(fp, "%s\n", line.c_str());
+    }
+    fclose(fp);
+    setIntegerParam(BFConfigFeatures, (int)saved.size());
+    callParamCallbacks();
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s saved %d features to %s\n",
+        driverName, functionName, (int)saved.size(), fileName);
+    return asynSuccess;
+}
+
+static bool endsWith(std::string const & name, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return (name.size() >= len) && (name.compare(name.size() - len, len, suffix) == 0);
+}
+
+/** Order in which saved features are restored.  Features that change the meaning or the limits of
+  * other features go first: the selectors and the image format, then the image size and offset,
+  * then the modes that enable or disable the values, and finally the values themselves.
+  */
+static int restoreRank(std::string const & name)
+{
+    if ((name == "PixelFormat") || (name.compare(0, 7, "Binning") == 0) ||
+        (name.compare(0, 10, "Decimation") == 0) || endsWith(name, "Selector")) return 0;
+    if ((name == "Width") || (name == "Height")) return 1;
+    if ((name == "OffsetX") || (name == "OffsetY")) return 2;
+    if (endsWith(name, "Mode") || endsWith(name, "Auto") || endsWith(name, "Enable") ||
+        endsWith(name, "Source") || endsWith(name, "Activation")) return 3;
+    return 4;
+}
+
+struct BFConfigItem {
+    BFFeature *pFeature;
+    char type;
+    std::string value;
+    int rank;
+};
+
+static bool compareRank(BFConfigItem const & a, BFConfigItem const & b)
+{
+    return a.rank < b.rank;
+}
+
+/** Restores a file written by saveConfig.  Only the values that differ from the camera are written.
+  * The features are written in dependency order (see restoreRank), and the writes the camera rejects
+  * are retried after the others, up to maxRestorePasses times, since a value can be out of range until
+  * a feature later in the file has been written (e.g. OffsetX before a smaller Width).
+  * Called with the lock held.
+  */
+asynStatus ADBitFlow::restoreConfig(const char *fileName)
+{
+    std::map<std::string, BFFeature *> featureMap;
+    std::vector<BFConfigItem> items, failed;
+    epicsTimeStamp startTime, endTime;
+    char line[512];
+    int written=0, unchanged=0, unknown=0;
+    static const char *functionName = "restoreConfig";
+
+    if (epicsAtomicGetIntT(&acquiring_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot restore the configuration while acquiring\n",
+            driverName, functionName);
+        return asynError;
+    }
+    FILE *fp = fopen(fileName, "r");
+    if (!fp) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot open %s\n",
+            driverName, functionName, fileName);
+        return asynError;
+    }
+    for (size_t i=0; i<features_.size(); i++) {
+        featureMap[features_[i]->getFeatureName()] = features_[i];
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        char name[256];
+        char type;
+        int valueStart = 0;
+        line[strcspn(line, "\r\n")] = 0;
+        if (sscanf(line, "%255s %c %n", name, &type, &valueStart) != 2) continue;
+        std::map<std::string, BFFeature *>::iterator it = featureMap.find(name);
+        if (it == featureMap.end()) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s unknown feature %s\n",
+                driverName, functionName, name);
+            unknown++;
+            continue;
+        }
+        BFConfigItem item;
+        item.pFeature = it->second;
+        item.type = type;
+        item.value = valueStart ? line + valueStart : "";
+        item.rank = restoreRank(name);
+        items.push_back(item);
+    }
+    fclose(fp);
+    std::stable_sort(items.begin(), items.end(), compareRank);
+
+    // Queued writes would be applied after the restored values
+    flushWrites();
+    epicsTimeGetCurrent(&startTime);
+    std::vector<BFConfigItem> pending = items;
+    for (int pass=0; (pass<maxRestorePasses) && !pending.empty(); pass++) {
+        failed.clear();
+        for (size_t i=0; i<pending.size(); i++) {
+            int result = pending[i].pFeature->restore(pending[i].type, pending[i].value);
+            if (result < 0)      failed.push_back(pending[i]);
+            else if (result > 0) written++;
+            else                 unchanged++;
+        }
+        if (failed.size() == pending.size()) break;
+        pending = failed;
+    }
+    epicsTimeGetCurrent(&endTime);
+    double restoreTime = epicsTimeDiffInSeconds(&endTime, &startTime);
+    for (size_t i=0; i<failed.size(); i++) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot restore %s=%s\n",
+            driverName, functionName, failed[i].pFeature->getFeatureName().c_str(), failed[i].value.c_str());
+    }
+    // The written features can change others, so read all of them back into the parameter library
+    for (size_t i=0; i<items.size(); i++) {
+        items[i].pFeature->read(NULL, true);
+    }
+    setIntegerParam(BFConfigFeatures, (int)items.size());
+    setIntegerParam(BFConfigWritten, written);
+    setIntegerParam(BFConfigFailed, (int)failed.size() + unknown);
+    setDoubleParam(BFConfigRestoreTime, restoreTime);
+    callParamCallbacks();
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s %s: %d features, %d written, %d unchanged, %d failed in %.3f s\n",
+        driverName, functionName, fileName, (int)items.size(), written, unchanged,
+        (int)failed.size() + unknown, restoreTime);
+    return (failed.empty() && !unknown) ? asynSuccess : asynError;
+}
+
+/** Called by BFFeature::resolve() with the time it took to open one node */
+void ADBitFlow::featureResolved(double seconds) {
+    nodesResolved_++;
+    nodeResolveTime_ += seconds;
+}
+
+/** Called from the initHookAfterIocRunning hook.  Records the startup time and launches
+  * resolveFeaturesThread so the nodes are opened before they are first used.
+  */
+void ADBitFlow::iocRunning()
+{
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    lock();
+    iocInitTime_ = epicsTimeDiffInSeconds(&now, &createTime_);
+    setDoubleParam(BFIocInitTime, iocInitTime_);
+    callParamCallbacks();
+    unlock();
+    epicsThreadCreate("ADBFResolveThread", 
+                      epicsThreadPriorityLow,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      resolveFeaturesThreadC, this);
+}
+
+/** Opens the GenICam nodes of all the features that have not been accessed yet, and checks the
+  * nodes that were loaded from the feature map against the camera.
+  * The lock is released between nodes so that record processing is not held off for the whole time.
+  */
+void ADBitFlow::resolveFeaturesThread()
+{
+    static const char *functionName = "resolveFeaturesThread";
+
+    lock();
+    for (size_t i=0; (i<features_.size()) && !exiting_; i++) {
+        features_[i]->resolve();
+        if (!features_[i]->validate()) featureMapMismatches_++;
+        unlock();
+        lock();
+    }
+    saveFeatureMap();
+    setIntegerParam(BFFeatureMapNodes, pFeatureMap_->getNumNodes());
+    setIntegerParam(BFFeatureMapMismatches, featureMapMismatches_);
+    callParamCallbacks();
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s opened %d nodes in %.3f s\n",
+        driverName, functionName, nodesResolved_, nodeResolveTime_);
+    unlock();
+}
+
+/** Launches one image processing thread */
+void ADBitFlow::startWorker()
+{
+    epicsThreadCreate("ADBFProcessImageThread", 
+                      epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      processImageThreadC, this);
+    numWorkers_++;
+}
+
+/** Grows or shrinks the worker pool between BFMinWorkers and BFMaxWorkers.
+  * A worker is added when messages are waiting for a free worker or the workers are busy more than
+  * workerHighUtilization of the time, and one is removed when they have been busy less than
+  * workerLowUtilization of the time for workerIdleIntervals status intervals.
+  * Called by statusThread with the lock held.
+  */
+void ADBitFlow::adjustWorkers()
+{
+    static const char *functionName = "adjustWorkers";
+    int minWorkers, maxWorkers;
+    double utilization = 0.;
+    epicsTimeStamp now;
+
+    // setBufferSize() is replacing the workers
+    if (resizing_) return;
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &lastAdjustTime_);
+    if (elapsed <= 0.) return;
+    lastAdjustTime_ = now;
+    if (numWorkers_ > 0) utilization = workerBusyTime_ / (elapsed * numWorkers_);
+    if (utilization > 1.) utilization = 1.;
+    workerBusyTime_ = 0.;
+    setDoubleParam(BFWorkerUtilization, utilization*100.);
+
+    getIntegerParam(BFMinWorkers, &minWorkers);
+    getIntegerParam(BFMaxWorkers, &maxWorkers);
+    int pending = pMsgQ_->pending();
+    if ((numWorkers_ < minWorkers) ||
+        ((numWorkers_ < maxWorkers) && ((pending > numWorkers_) || (utilization > workerHighUtilization)))) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s adding worker, workers=%d, pending=%d, utilization=%.2f\n",
+            driverName, functionName, numWorkers_, pending, utilization);
+        startWorker();
+        idleIntervals_ = 0;
+    } else if ((numWorkers_ > maxWorkers) ||
+               ((numWorkers_ > minWorkers) && (pending == 0) && (utilization < workerLowUtilization) &&
+                (++idleIntervals_ >= workerIdleIntervals))) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s removing worker, workers=%d, utilization=%.2f\n",
+            driverName, functionName, numWorkers_, utilization);
+        // Whichever worker receives this message exits
+        struct workerQueueElement wqe;
+        memset(&wqe, 0, sizeof(wqe));
+        wqe.uniqueId = workerExitId;
+        if (pMsgQ_->trySend(&wqe, sizeof(wqe)) == 0) numWorkers_--;
+        idleIntervals_ = 0;
+    } else if (utilization >= workerLowUtilization) {
+        idleIntervals_ = 0;
+    }
+    setIntegerParam(BFNumWorkers, numWorkers_);
+}
+
+/** Sets the CPU affinity and scheduling of the calling thread.
+  * Called by the acquisition threads when they start.  The thread also prefers to allocate memory
+  * on the NUMA node of the board, so the NDArray buffers it first touches are local to the DMA buffers.
+  * \param[in] cpus The CPUs the thread may run on.  Empty=no restriction.
+  * \param[in] priority SCHED_FIFO priority.  <=0=leave the EPICS scheduling.
+  */
+void ADBitFlow::placeThread(std::vector<int> const & cpus, int priority)
+{
+    static const char *functionName = "placeThread";
+    int status;
+
+    status = setThreadAffinity(cpus);
+    if (status) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s thread %s error setting affinity to CPUs %s, error=%d\n",
+            driverName, functionName, epicsThreadGetNameSelf(), formatCPUList(cpus).c_str(), status);
+    }
+    status = setThreadMemoryNode(numaNode_);
+    if (status) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s thread %s error setting memory policy to NUMA node %d, error=%d\n",
+            driverName, functionName, epicsThreadGetNameSelf(), numaNode_, status);
+    }
+    status = setThreadRealTimePriority(priority);
+    if (status) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s thread %s error setting real-time priority %d, error=%d\n",
+            driverName, functionName, epicsThreadGetNameSelf(), priority, status);
+    }
+}
+
+/** Prints the most recent per-frame trace records.
+  * \param[in] fp File pointer to write output to
+  * \param[in] count Number of records to print.  0 prints all of them.
+  */
+void ADBitFlow::traceDump(FILE *fp, int count)
+{
+    if (!pTracer_) {
+        fprintf(fp, "%s: per-frame tracing is not enabled, rebuild with -DBF_FRAME_TRACE\n", driverName);
+        return;
+    }
+    pTracer_->dump(fp, count);
+}
+
+/** Writes the per-frame trace records in Chrome trace event JSON format.
+  * \param[in] fileName Name of the output file, which can be opened in Perfetto
+  * \param[in] seconds Only records from the last seconds are written.  0 writes all of them.
+  */
+void ADBitFlow::traceChrome(const char *fileName, double seconds)
+{
+    if (!pTracer_) {
+        printf("%s: per-frame tracing is not enabled, rebuild with -DBF_FRAME_TRACE\n", driverName);
+        return;
+    }
+    if (pTracer_->writeChrome(fileName, seconds)) {
+        printf("%s: cannot open file %s\n", driverName, fileName);
+    }
+}
+
 void ADBitFlow::shutdown(void)
 {
     //static const char *functionName = "shutdown";
     
+    // The event threads take the lock to deliver the events
+    if (pDeviceEvents_) pDeviceEvents_->stop();
     lock();
     exiting_ = 1;
+    epicsEventSignal(statusEventId_);
+    epicsEventSignal(pollEventId_);
+    epicsEventSignal(writeEventId_);
+    epicsEventSignal(previewEventId_);
+    saveFeatureMap();
     stopCapture();
+    // The pool frees the buffers when the driver is destroyed
+    unlockMemoryAll();
     #ifdef _WIN32
       delete pBoard_;
     #else
@@ -224,7 +991,15 @@ void ADBitFlow::shutdown(void)
 GenICamFeature *ADBitFlow::createFeature(GenICamFeatureSet *set, 
                                            std::string const & asynName, asynParamType asynType, int asynIndex,
                                            std::string const & featureName, GCFeatureType_t featureType) {
-    return new BFFeature(set, asynName, asynType, asynIndex, featureName, featureType);
+    BFFeature *pFeature = new BFFeature(set, asynName, asynType, asynIndex, featureName, featureType);
+    lock();
+    features_.push_back(pFeature);
+    std::map<std::string, int>::iterator it = pollClasses_.find(featureName);
+    if (it != pollClasses_.end()) {
+        pFeature->setPollClass((BFPollClass_t)it->second);
+    }
+    unlock();
+    return pFeature;
 }
 
 asynStatus ADBitFlow::connectCamera(void)
@@ -296,6 +1071,13 @@ asynStatus ADBitFlow::connectCamera(void)
     epicsSnprintf(SDKVersionString, sizeof(SDKVersionString), "%d.%d", libVers, drvVers);
     
 #endif
+    sdkVersion_ = SDKVersionString;
+    // Find the NUMA node the board is attached to so the acquisition threads and their memory can be placed there
+    if (findBoardNUMANode(boardNum_, boardPCIAddress_, &numaNode_, numaCPUs_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s cannot find the PCI device for board %d, threads will not be placed on its NUMA node\n",
+            driverName, functionName, boardNum_);
+    }
     epicsSnprintf(driverVersionString, sizeof(driverVersionString), "%d.%d.%d", 
                   DRIVER_VERSION, DRIVER_REVISION, DRIVER_MODIFICATION);
     setStringParam(NDDriverVersion,driverVersionString);
@@ -312,13 +1094,26 @@ asynStatus ADBitFlow::connectCamera(void)
 
 void ADBitFlow::waitImageThread()
 {
-    int BFStatus, BFStatus1;
+    int BFStatus;
     int numImages;
     int imageMode;
     int imagesCollected;
+    int processingMode = ProcessingWorkers;
+    double waitSpinTime = 0.;
+    double stallTimeout;
+    int waitTimeout = -1;
     bool waitingForImages = false;
+#ifdef _WIN32
+    int BFStatus1;
+    epicsTimeStamp arrivalTime;
+#else
+    struct workerQueueElement frameBatch[maxFrameBatch];
+#endif
     static const char *functionName = "waitImageThread";
 
+    // By default the wait thread runs on the CPUs local to the board
+    placeThread(waitThreadCPUs_.empty() ? numaCPUs_ : waitThreadCPUs_, realTimePriority_);
+
     lock();
 
     while (1) {
@@ -329,6 +1124,7 @@ void ADBitFlow::waitImageThread()
                 "%s::%s waiting for acquire to start\n", 
                 driverName, functionName);
             setIntegerParam(ADStatus, ADStatusIdle);
+            updateStatus();
             callParamCallbacks();
             // Release the lock while we wait for an event that says acquire has started, then lock again
             unlock();
@@ -337,40 +1133,63 @@ void ADBitFlow::waitImageThread()
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
                 "%s::%s started!\n", 
                 driverName, functionName);
+            epicsAtomicSetIntT(&numImagesCounter_, 0);
             setIntegerParam(ADNumImagesCounter, 0);
             setIntegerParam(ADAcquire, 1);
             getIntegerParam(ADNumImages, &numImages);
             getIntegerParam(ADImageMode, &imageMode);
+            getIntegerParam(BFProcessingMode, &processingMode);
+            getIntegerParam(BFWaitStrategy, &waitStrategy_);
+            getDoubleParam(BFWaitSpinTime, &waitSpinTime);
+#ifdef _WIN32
+            // waitDoneFrame always blocks
+            waitStrategy_ = WaitBlocking;
+#endif
+            if ((waitStrategy_ < WaitBlocking) || (waitStrategy_ > WaitHybrid)) waitStrategy_ = WaitBlocking;
+            epicsTimeGetCurrent(&lastFrameTime_);
+            frameInterval_ = 0.;
+            stalled_ = false;
+            setIntegerParam(BFStalled, 0);
             imagesCollected = 0;
             waitingForImages = true;
+            // The status is not changed per frame, statusThread publishes the counters while acquiring
+            setIntegerParam(ADStatus, ADStatusAcquire);
+            callParamCallbacks();
         }
+        // With the watchdog enabled the waits time out periodically so a stall can be detected.
+        // This is read on every pass so that changing BFStallTimeout takes effect during acquisition.
+        getDoubleParam(BFStallTimeout, &stallTimeout);
+        waitTimeout = (stallTimeout > 0.) ? watchdogPeriodMs : -1;
 
-        // We are now waiting for an image
-        setIntegerParam(ADStatus, ADStatusWaiting);
-
-        // Call the callbacks to update any changes
-        callParamCallbacks();
-
-        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s waiting for frame\n", driverName, functionName);
 #ifdef _WIN32
         BiCirHandle cirHandle;
         unlock();
-        BFStatus = pBoard_->waitDoneFrame(INFINITE, &cirHandle);
-        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s got frame status=%d, bufferNumber=%d\n", 
-                  driverName, functionName, BFStatus, cirHandle.BufferNumber);
+        BF_TRACE_BEGIN(pTracer_, BFTraceWaitFrame, imagesCollected);
+        BFStatus = pBoard_->waitDoneFrame((waitTimeout < 0) ? INFINITE : waitTimeout, &cirHandle);
+        epicsTimeGetCurrent(&arrivalTime);
+        BF_TRACE_END(pTracer_, BFTraceWaitFrame, imagesCollected);
+        BF_TRACE(pTracer_, BFTraceGotFrame, BFStatus, cirHandle.BufferNumber);
+        BF_TRACE_BEGIN(pTracer_, BFTraceLock, imagesCollected);
         lock();
+        BF_TRACE_END(pTracer_, BFTraceLock, imagesCollected);
         switch (BFStatus) {
           case BI_OK: {
+              frameArrived(arrivalTime);
               // Mark the buffer to hold
-              asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s calling setBufferStatus for BIHOLD\n", driverName, functionName);
               BFStatus1 = pBoard_->setBufferStatus(cirHandle, BIHOLD);
-              asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s setBufferStatus returned %d\n", driverName, functionName, BFStatus1);
-              // Send a message to the processing thread
-              struct workerQueueElement wqe{cirHandle, uniqueId_};
+              BF_TRACE(pTracer_, BFTraceHoldBuffer, BFStatus1, cirHandle.BufferNumber);
+              // Process the frame in this thread or send a message to the processing thread
+              struct workerQueueElement wqe{cirHandle, uniqueId_, arrivalTime};
               uniqueId_++;
-              asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s sending message\n", driverName, functionName);
-              if (pMsgQ_->send(&wqe, sizeof(wqe)) != 0) {
-                  asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error calling pMsgQ_->send()\n", driverName, functionName);
+              if (processingMode == ProcessingInline) {
+                  processFrame(&wqe);
+              } else {
+                  BF_TRACE(pTracer_, BFTraceSendMessage, wqe.uniqueId, pMsgQ_->pending());
+                  epicsAtomicIncrIntT(&framesInFlight_);
+                  if (pMsgQ_->send(&wqe, sizeof(wqe)) != 0) {
+                      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error calling pMsgQ_->send()\n", driverName, functionName);
+                      epicsAtomicDecrIntT(&framesInFlight_);
+                  }
               }
               imagesCollected++;
               if ((imageMode == ADImageSingle) || ((imageMode == ADImageMultiple) && (imagesCollected >= numImages))) {
@@ -386,6 +1205,11 @@ void ADBitFlow::waitImageThread()
             waitingForImages = false;
             break;
           case BI_CIR_ABORTED:
+             if (recovering_) {
+                 // From the abort in recoverAcquisition(), the acquisition has been restarted
+                 recovering_ = false;
+                 break;
+             }
              asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                        "%s::%s Circular acquisition aborted\n",
                        driverName, functionName);
@@ -394,6 +1218,10 @@ void ADBitFlow::waitImageThread()
              waitingForImages = false;
              break;
           case BI_ERROR_CIR_WAIT_TIMEOUT:
+             if (waitTimeout > 0) {
+                 checkStall();
+                 break;
+             }
              asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                        "%s::%s Circular wait timeout\n",
                        driverName, functionName);
@@ -415,38 +1243,110 @@ void ADBitFlow::waitImageThread()
              break;
         }
 #else
-        tCIU32 frameID;
-        tCIU8 *pFrame;
-        BFStatus = CiGetOldestNotDeliveredFrame(hBoard_, &frameID, &pFrame);
-        switch (BFStatus) {
-          case kCIEnoErr: {
-              // Mark the buffer to hold
-              //stat = pBoard_->setBufferStatus(cirHandle, BIHOLD);
-              // Send a message to the processing thread
-              struct workerQueueElement wqe{frameID, pFrame, uniqueId_};
-              uniqueId_++;
-              asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s sending message\n", driverName, functionName);
-              if (pMsgQ_->send(&wqe, sizeof(wqe)) != 0) {
-                  asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error calling pMsgQ_->send()\n", driverName, functionName);
-              }
-              imagesCollected++;
-              if ((imageMode == ADImageSingle) || ((imageMode == ADImageMultiple) && (imagesCollected >= numImages))) {
-                  CiAqAbort(hBoard_);
-                  waitingForImages = false;
-              }
+        // Collect the frames that are already available without holding the lock.
+        // The extra frame info (hardware timestamp) is read here so the workers do not call into the driver,
+        // and a backlog is handed to the workers with a single lock acquisition.
+        // In inline mode each frame is processed as soon as it arrives.
+        int maxFrames = maxFrameBatch;
+        if ((imageMode == ADImageSingle) || (processingMode == ProcessingInline)) maxFrames = 1;
+        if ((imageMode == ADImageMultiple) && (numImages - imagesCollected < maxFrames)) maxFrames = numImages - imagesCollected;
+        if (maxFrames < 1) maxFrames = 1;
+        int numFrames = 0;
+        unlock();
+        while (numFrames < maxFrames) {
+            struct workerQueueElement *pWqe = &frameBatch[numFrames];
+            BFStatus = CiGetOldestNotDeliveredFrame(hBoard_, &pWqe->frameID, &pWqe->pFrame);
+            BF_TRACE(pTracer_, BFTraceGotFrame, BFStatus, pWqe->frameID);
+            if (BFStatus != kCIEnoErr) break;
+            epicsTimeGetCurrent(&pWqe->arrivalTime);
+            memset(&pWqe->extraInfo, 0, sizeof(pWqe->extraInfo));
+            pWqe->extraInfo.frameID = pWqe->frameID;
+            CiGetExtraFrameInfo(hBoard_, sizeof(pWqe->extraInfo), &pWqe->extraInfo);
+            numFrames++;
+        }
+        if ((numFrames == 0) && (BFStatus == kCIEnoNewData)) {
+            BF_TRACE_BEGIN(pTracer_, BFTraceWaitFrame, imagesCollected);
+            if (waitStrategy_ != WaitBlocking) {
+                // Poll rather than paying for a kernel wakeup.  The loop ends when a frame arrives,
+                // on an error, when stopCapture() is called, for hybrid after the spin time,
+                // and with the watchdog enabled after the watchdog period.
+                epicsUInt64 pollStart = epicsMonotonicGet();
+                epicsUInt64 spinEnd = pollStart + (epicsUInt64)(waitSpinTime*1000.);
+                epicsUInt64 pollEnd = pollStart + (epicsUInt64)watchdogPeriodMs*1000000;
+                while ((BFStatus == kCIEnoNewData) && epicsAtomicGetIntT(&acquiring_)) {
+                    if ((waitStrategy_ == WaitHybrid) && (epicsMonotonicGet() >= spinEnd)) break;
+                    if ((waitTimeout > 0) && (epicsMonotonicGet() >= pollEnd)) break;
+                    BFStatus = CiGetOldestNotDeliveredFrame(hBoard_, &frameBatch[0].frameID, &frameBatch[0].pFrame);
+                }
+                if (BFStatus == kCIEnoErr) {
+                    struct workerQueueElement *pWqe = &frameBatch[0];
+                    epicsTimeGetCurrent(&pWqe->arrivalTime);
+                    memset(&pWqe->extraInfo, 0, sizeof(pWqe->extraInfo));
+                    pWqe->extraInfo.frameID = pWqe->frameID;
+                    CiGetExtraFrameInfo(hBoard_, sizeof(pWqe->extraInfo), &pWqe->extraInfo);
+                    numFrames = 1;
+                }
+            }
+            if ((BFStatus == kCIEnoNewData) && (waitStrategy_ != WaitBusyPoll) && epicsAtomicGetIntT(&acquiring_)) {
+                BFStatus = CiWaitNextUndeliveredFrame(hBoard_, waitTimeout);
+            }
+            BF_TRACE_END(pTracer_, BFTraceWaitFrame, imagesCollected);
+        }
+        lock();
+        if (numFrames > 0) {
+            // Process the frame in this thread or send messages to the processing threads
+            for (int i=0; i<numFrames; i++) {
+                struct workerQueueElement *pWqe = &frameBatch[i];
+                pWqe->uniqueId = uniqueId_++;
+                frameArrived(pWqe->arrivalTime);
+                // How much later than predicted from the hardware clock this thread saw the frame.
+                // The model is fitted on these same arrival times, so this is the jitter of the arrival
+                // around the fit, not the absolute wakeup latency.
+                double hwTime = (double)pWqe->extraInfo.timestamp;
+                epicsTimeStamp predicted;
+                pJitterModel_->addSample(hwTime, pWqe->arrivalTime);
+                if (pJitterModel_->predict(hwTime, &predicted)) {
+                    pArrivalJitter_[waitStrategy_]->add(epicsTimeDiffInSeconds(&pWqe->arrivalTime, &predicted));
+                }
+                if (processingMode == ProcessingInline) {
+                    processFrame(pWqe);
+                    continue;
+                }
+                BF_TRACE(pTracer_, BFTraceSendMessage, pWqe->uniqueId, pMsgQ_->pending());
+                epicsAtomicIncrIntT(&framesInFlight_);
+                if (pMsgQ_->send(pWqe, sizeof(*pWqe)) != 0) {
+                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error calling pMsgQ_->send()\n", driverName, functionName);
+                    epicsAtomicDecrIntT(&framesInFlight_);
+                }
+            }
+            imagesCollected += numFrames;
+            if ((imageMode == ADImageSingle) || ((imageMode == ADImageMultiple) && (imagesCollected >= numImages))) {
+                CiAqAbort(hBoard_);
+                waitingForImages = false;
             }
+            continue;
+        }
+        switch (BFStatus) {
+          case kCIEnoErr:
+            // CiWaitNextUndeliveredFrame returned because a frame is available
             break;
           case kCIEnoNewData:
-            BFStatus1 = CiWaitNextUndeliveredFrame(hBoard_, -1);
-            if (BFStatus1 == kCIEnoErr) break;
-            if (BFStatus1 != kCIEaqAbortedErr) {
-              asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                        "%s::%s Unknown status return from CiGetNextUndeliveredFrame = %d\n",
-                        driverName, functionName, BFStatus1);
-              break;
+            // The polling ended at the watchdog period or because stopCapture() was called
+            if (epicsAtomicGetIntT(&acquiring_)) {
+                checkStall();
+            } else {
+                waitingForImages = false;
             }
-            // Fall through if aborted
+            break;
+          case kCIEtimeoutErr:
+            checkStall();
+            break;
           case kCIEaqAbortedErr:
+             if (recovering_) {
+                 // From the abort in recoverAcquisition(), the acquisition has been restarted
+                 recovering_ = false;
+                 break;
+             }
              asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                        "%s::%s Circular acquisition aborted\n",
                        driverName, functionName);
@@ -456,7 +1356,7 @@ void ADBitFlow::waitImageThread()
              break;
           default:
              asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                       "%s::%s Unknown status return from CiGetOldestNotDeliveredFrame = %d\n",
+                       "%s::%s Unknown status return from CiGetOldestNotDeliveredFrame or CiWaitNextUndeliveredFrame = %d\n",
                        driverName, functionName, BFStatus);
              break;
         }
@@ -465,12 +1365,107 @@ void ADBitFlow::waitImageThread()
 }
 
 void ADBitFlow::processImageThread()
+{
+    struct workerQueueElement wqe;
+    static const char *functionName = "processImageThread";
+
+    // Spread the workers over workerThreadCPUs_, one CPU each, on the CPU with the fewest workers so that
+    // the CPUs of workers that have exited are used again.
+    // By default they may run on any of the CPUs local to the board.
+    int cpuIndex = -1;
+    std::vector<int> cpus = numaCPUs_;
+    lock();
+    for (size_t i=0; i<workerCPUUse_.size(); i++) {
+        if ((cpuIndex < 0) || (workerCPUUse_[i] < workerCPUUse_[cpuIndex])) cpuIndex = (int)i;
+    }
+    if (cpuIndex >= 0) {
+        workerCPUUse_[cpuIndex]++;
+        cpus.assign(1, workerThreadCPUs_[cpuIndex]);
+    }
+    unlock();
+    placeThread(cpus, (realTimePriority_ > 1) ? realTimePriority_-1 : realTimePriority_);
+    epicsAtomicIncrIntT(&workersRunning_);
+
+    lock();
+    while (true) {
+        unlock();
+        BF_TRACE_BEGIN(pTracer_, BFTraceDequeue, 0);
+        int recvSize = pMsgQ_->receive(&wqe, sizeof(wqe));
+        BF_TRACE_END(pTracer_, BFTraceDequeue, wqe.uniqueId);
+        BF_TRACE_BEGIN(pTracer_, BFTraceLock, wqe.uniqueId);
+        lock();
+        BF_TRACE_END(pTracer_, BFTraceLock, wqe.uniqueId);
+        if (recvSize != sizeof(wqe)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s error receiving from message queue\n",
+                    driverName, functionName);
+            continue;
+        }
+        if (wqe.uniqueId == workerExitId) break;
+        epicsUInt64 startTime = epicsMonotonicGet();
+        processFrame(&wqe);
+        workerBusyTime_ += (epicsMonotonicGet() - startTime)/1e9;
+        epicsAtomicDecrIntT(&framesInFlight_);
+    }
+    if (cpuIndex >= 0) workerCPUUse_[cpuIndex]--;
+    epicsAtomicDecrIntT(&workersRunning_);
+    unlock();
+}
+
+#ifndef _WIN32
+/* BFciLib.h has no version macro, and the members of tCIextraFrameInfo other than frameID and timestamp
+ * differ between SDK versions.  For each member below addExtraInfo_<member>() attaches it if the installed
+ * tCIextraFrameInfo has it, which is decided at compile time, and otherwise does nothing.
+ */
+#define BF_EXTRA_INFO_MEMBER(member, attrName, description) \
+    template <typename T> \
+    static auto addExtraInfo_##member(NDAttributeList *pList, T const & info, int) -> decltype((void)info.member) \
+    { \
+        if (sizeof(info.member) > sizeof(epicsUInt32)) { \
+            epicsUInt64 value = (epicsUInt64)info.member; \
+            pList->add(attrName, description, NDAttrUInt64, &value); \
+        } else { \
+            epicsUInt32 value = (epicsUInt32)info.member; \
+            pList->add(attrName, description, NDAttrUInt32, &value); \
+        } \
+    } \
+    template <typename T> \
+    static void addExtraInfo_##member(NDAttributeList *, T const &, long) {}
+
+BF_EXTRA_INFO_MEMBER(frameCount,  "BFFrameCount",   "BitFlow frame count")
+BF_EXTRA_INFO_MEMBER(bufferID,    "BFBufferNumber", "BitFlow buffer number")
+BF_EXTRA_INFO_MEMBER(lineCount,   "BFLineCount",    "BitFlow lines in the frame")
+BF_EXTRA_INFO_MEMBER(hwTimeStamp, "BFHWTimeStamp",  "BitFlow board time stamp")
+BF_EXTRA_INFO_MEMBER(flags,       "BFFrameFlags",   "BitFlow frame flags")
+BF_EXTRA_INFO_MEMBER(status,      "BFFrameStatus",  "BitFlow frame status")
+
+/** Attaches the hardware flags and counters of the frame in tCIextraFrameInfo, other than frameID and
+  * timestamp, to an NDArray.  The attribute names are the same for every SDK version.
+  */
+static void addExtraInfoAttributes(NDAttributeList *pList, tCIextraFrameInfo const & info)
+{
+    addExtraInfo_frameCount(pList, info, 0);
+    addExtraInfo_bufferID(pList, info, 0);
+    addExtraInfo_lineCount(pList, info, 0);
+    addExtraInfo_hwTimeStamp(pList, info, 0);
+    addExtraInfo_flags(pList, info, 0);
+    addExtraInfo_status(pList, info, 0);
+}
+#endif
+
+/** Copies one frame into an NDArray, releases the BitFlow buffer and does the NDArray callbacks.
+  * Called by the worker threads, or by waitImageThread in inline processing mode.
+  * Must be called with the lock held, the lock is released while the data is copied.
+  * \param[in] pWqe The frame to process.
+  */
+void ADBitFlow::processFrame(struct workerQueueElement *pWqe)
 {
     NDArray *pRaw = 0;
     size_t nRows, nCols;
     NDDataType_t dataType = NDUInt8;
     NDColorMode_t colorMode = NDColorModeMono;
     int timeStampMode;
+    int clockSync;
     int uniqueIdMode;
     int numColors=1;
     size_t dims[3];
@@ -480,195 +1475,751 @@ void ADBitFlow::processImageThread()
     void *pData;
     int nDims;
     int numImages;
-    int imageCounter;
     int numImagesCounter;
     int imageMode;
     int arrayCallbacks;
     epicsTime t1, t2, t3, t4;
-    struct workerQueueElement wqe;
-    static const char *functionName = "processImageThread";
+    epicsTimeStamp doneTime;
+    static const char *functionName = "processFrame";
 
-    while (true) {
-        unlock();
-        int recvSize = pMsgQ_->receive(&wqe, sizeof(wqe));
-        t1=t2=t3=t4 = epicsTime::getCurrent();
-        lock();
-        if (recvSize != sizeof(wqe)) {
-            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s error receiving from message queue\n",
-                    driverName, functionName);
-            continue;
-        }
-        // If acquisition has stopped then ignore this frame
-        //getIntegerParam(ADAcquire, &acquire);
-        //if (!acquire) continue;
+    t1=t2=t3=t4 = epicsTime::getCurrent();
+    // If acquisition has stopped then ignore this frame
+    //getIntegerParam(ADAcquire, &acquire);
+    //if (!acquire) return;
 
 #ifdef _WIN32
-        BiCirHandle cirHandle;
-        cirHandle = wqe.cirHandle;
-        pData = cirHandle.pBufData;
-        
-        // Get the image information
-        nCols = pBoard_->getBrdInfo(BiCamInqXSize);
-        nRows = pBoard_->getBrdInfo(BiCamInqYSize0);
-        pixelSize = pBoard_->getBrdInfo(BiCamInqBytesPerPix);
-        frameSize = pBoard_->getBrdInfo(BiCamInqFrameSize0);
-        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                  "%s::%s nCols=%u, nRows=%u, pixelSize=%u, frameSize=%u, BufferNumber=%u, FrameCount=%u, NumItemsOnQueue=%u\n",
-                  driverName, functionName, nCols, nRows, pixelSize, frameSize, cirHandle.BufferNumber, cirHandle.FrameCount, cirHandle.NumItemsOnQueue);
+    BiCirHandle cirHandle;
+    cirHandle = pWqe->cirHandle;
+    pData = cirHandle.pBufData;
+    
+    // Get the image information
+    nCols = pBoard_->getBrdInfo(BiCamInqXSize);
+    nRows = pBoard_->getBrdInfo(BiCamInqYSize0);
+    pixelSize = pBoard_->getBrdInfo(BiCamInqBytesPerPix);
+    frameSize = pBoard_->getBrdInfo(BiCamInqFrameSize0);
+    BF_TRACE(pTracer_, BFTraceFrameInfo, cirHandle.BufferNumber, cirHandle.FrameCount);
 #else
-        int iTemp;
-        getIntegerParam(ADSizeX, &iTemp);
-        nCols = iTemp;
-        getIntegerParam(ADSizeY, &iTemp);
-        nRows = iTemp;
-        pixelSize = bitsPerPixel_/8;
-        frameSize = nCols * nRows * pixelSize;
-        pData = wqe.pFrame;
+    int iTemp;
+    getIntegerParam(ADSizeX, &iTemp);
+    nCols = iTemp;
+    getIntegerParam(ADSizeY, &iTemp);
+    nRows = iTemp;
+    pixelSize = bitsPerPixel_/8;
+    frameSize = nCols * nRows * pixelSize;
+    pData = pWqe->pFrame;
 #endif
 
-        if (numColors == 1) {
-            nDims = 2;
-            dims[0] = nCols;
-            dims[1] = nRows;
+    if (numColors == 1) {
+        nDims = 2;
+        dims[0] = nCols;
+        dims[1] = nRows;
+    } else {
+        nDims = 3;
+        dims[0] = 3;
+        dims[1] = nCols;
+        dims[2] = nRows;
+    }
+    dataSize = dims[0] * dims[1] * pixelSize;
+    if (nDims == 3) dataSize *= dims[2];
+    if (dataSize != frameSize) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: data size mismatch: calculated=%lu, reported=%lu\n",
+            driverName, functionName, (long)dataSize, (long)frameSize);
+    }
+    setIntegerParam(NDArraySizeX, (int)nCols);
+    setIntegerParam(NDArraySizeY, (int)nRows);
+    setIntegerParam(NDArraySize, (int)dataSize);
+    setIntegerParam(NDDataType, dataType);
+    if (nDims == 3) {
+        colorMode = NDColorModeRGB1;
+    } 
+    setIntegerParam(NDColorMode, colorMode);
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    if (arrayCallbacks) {
+        BF_TRACE_BEGIN(pTracer_, BFTraceAllocArray, pWqe->uniqueId);
+        pRaw = pNDArrayPool->alloc(nDims, dims, dataType, dataSize, NULL);
+        BF_TRACE_END(pTracer_, BFTraceAllocArray, pWqe->uniqueId);
+        if (!pRaw) {
+            // If we didn't get a valid buffer from the NDArrayPool we must abort
+            // the acquisition as we have nowhere to dump the data...
+            setIntegerParam(ADStatus, ADStatusAborting);
+            callParamCallbacks();
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s::%s [%s] ERROR: Serious problem: not enough buffers left! Aborting acquisition!\n",
+                driverName, functionName, portName);
+            setIntegerParam(ADAcquire, 0);
+            return;
+        }
+        if (pData) {
+            unlock();
+            BF_TRACE_BEGIN(pTracer_, BFTraceCopyData, pWqe->uniqueId);
+            t2 = epicsTime::getCurrent();
+            memcpy(pRaw->pData, pData, dataSize);
+            t3 = epicsTime::getCurrent();
+            BF_TRACE_END(pTracer_, BFTraceCopyData, pWqe->uniqueId);
+            BF_TRACE_BEGIN(pTracer_, BFTraceLock, pWqe->uniqueId);
+            lock();
+            BF_TRACE_END(pTracer_, BFTraceLock, pWqe->uniqueId);
         } else {
-            nDims = 3;
-            dims[0] = 3;
-            dims[1] = nCols;
-            dims[2] = nRows;
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s::%s [%s] ERROR: pData is NULL!\n",
+                driverName, functionName, portName);
+            return;
         }
-        dataSize = dims[0] * dims[1] * pixelSize;
-        if (nDims == 3) dataSize *= dims[2];
-        if (dataSize != frameSize) {
-            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s: data size mismatch: calculated=%lu, reported=%lu\n",
-                driverName, functionName, (long)dataSize, (long)frameSize);
-        }
-        setIntegerParam(NDArraySizeX, (int)nCols);
-        setIntegerParam(NDArraySizeY, (int)nRows);
-        setIntegerParam(NDArraySize, (int)dataSize);
-        setIntegerParam(NDDataType, dataType);
-        if (nDims == 3) {
-            colorMode = NDColorModeRGB1;
-        } 
-        setIntegerParam(NDColorMode, colorMode);
-        getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
-        if (arrayCallbacks) {
-            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s allocating pRaw\n", driverName, functionName);
-            pRaw = pNDArrayPool->alloc(nDims, dims, dataType, 0, NULL);
-            if (!pRaw) {
-                // If we didn't get a valid buffer from the NDArrayPool we must abort
-                // the acquisition as we have nowhere to dump the data...
-                setIntegerParam(ADStatus, ADStatusAborting);
-                callParamCallbacks();
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                    "%s::%s [%s] ERROR: Serious problem: not enough buffers left! Aborting acquisition!\n",
-                    driverName, functionName, portName);
-                setIntegerParam(ADAcquire, 0);
-                continue;
-            }
-            if (pData) {
-                asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s copying data\n", driverName, functionName);
-                unlock();
-                t2 = epicsTime::getCurrent();
-                memcpy(pRaw->pData, pData, dataSize);
-                t3 = epicsTime::getCurrent();
-                lock();
-            } else {
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                    "%s::%s [%s] ERROR: pData is NULL!\n",
-                    driverName, functionName, portName);
-                continue;
-            }
-        
-            // Put the frame number into the buffer
-            getIntegerParam(BFUniqueIdMode, &uniqueIdMode);
-            if (uniqueIdMode == UniqueIdCamera) {
+    
+        // Put the frame number into the buffer
+        BF_TRACE_BEGIN(pTracer_, BFTraceAttributes, pWqe->uniqueId);
+        getIntegerParam(BFUniqueIdMode, &uniqueIdMode);
+        if (uniqueIdMode == UniqueIdCamera) {
 #ifdef _WIN32
-                pRaw->uniqueId = cirHandle.FrameCount;
+            pRaw->uniqueId = cirHandle.FrameCount;
 #else
-                pRaw->uniqueId = wqe.frameID;
+            pRaw->uniqueId = pWqe->frameID;
 #endif         
-            } else {
-                pRaw->uniqueId = wqe.uniqueId;
-            }
-            updateTimeStamp(&pRaw->epicsTS);
-            getIntegerParam(BFTimeStampMode, &timeStampMode);
-            // Set the timestamps in the buffer
-            if (timeStampMode == TimeStampCamera) {
+        } else {
+            pRaw->uniqueId = pWqe->uniqueId;
+        }
+        updateTimeStamp(&pRaw->epicsTS);
+        getIntegerParam(BFTimeStampMode, &timeStampMode);
+        getIntegerParam(BFClockSync, &clockSync);
+        // Set the timestamps in the buffer
+        if (timeStampMode == TimeStampCamera) {
 #ifdef _WIN32
-                // Should use cirHandle.HiResTimeStamp but its fields are all zero?
-                pRaw->timeStamp = cirHandle.TimeStamp.hour*3600 + 
-                                  cirHandle.TimeStamp.min*60 + 
-                                  cirHandle.TimeStamp.sec +
-                                  cirHandle.TimeStamp.msec/1000.;
+            // Should use cirHandle.HiResTimeStamp but its fields are all zero?
+            pRaw->timeStamp = cirHandle.TimeStamp.hour*3600 + 
+                              cirHandle.TimeStamp.min*60 + 
+                              cirHandle.TimeStamp.sec +
+                              cirHandle.TimeStamp.msec/1000.;
 #else
-                tCIextraFrameInfo extraInfo;
-                extraInfo.frameID = wqe.frameID;
-                CiGetExtraFrameInfo(hBoard_, sizeof(extraInfo), &extraInfo);
-                pRaw->timeStamp = extraInfo.timestamp;
+            // The extra frame info was read by waitImageThread
+            pRaw->timeStamp = (double)pWqe->extraInfo.timestamp;
 #endif
-            } else {
-                pRaw->timeStamp = pRaw->epicsTS.secPastEpoch + pRaw->epicsTS.nsec/1e9;
+            // Derive epicsTS from the hardware timestamp using the fitted clock model.
+            // Until the model has enough samples use the time the frame arrived.
+            if (clockSync) {
+                pClockModel_->addSample(pRaw->timeStamp, pWqe->arrivalTime);
+                if (!pClockModel_->predict(pRaw->timeStamp, &pRaw->epicsTS)) {
+                    pRaw->epicsTS = pWqe->arrivalTime;
+                }
             }
-    
-            // Get any attributes that have been defined for this driver        
-            getAttributes(pRaw->pAttributeList);
-            
-            // Change the status to be readout...
-            setIntegerParam(ADStatus, ADStatusReadout);
-        
-            pRaw->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        } else {
+            pRaw->timeStamp = pRaw->epicsTS.secPastEpoch + pRaw->epicsTS.nsec/1e9;
         }
 
-        // Mark the buffer as available
-        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s marking buffer as available\n", driverName, functionName);
+        // Get any attributes that have been defined for this driver        
+        getAttributes(pRaw->pAttributeList);
+    
+        pRaw->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
 #ifdef _WIN32
-        pBoard_->setBufferStatus(cirHandle, BIAVAILABLE);
+        epicsUInt32 frameCount = cirHandle.FrameCount;
+        epicsUInt32 bufferNumber = cirHandle.BufferNumber;
+        epicsUInt32 numItemsOnQueue = cirHandle.NumItemsOnQueue;
+        pRaw->pAttributeList->add("BFFrameCount", "BitFlow frame count", NDAttrUInt32, &frameCount);
+        pRaw->pAttributeList->add("BFBufferNumber", "BitFlow buffer number", NDAttrUInt32, &bufferNumber);
+        pRaw->pAttributeList->add("BFQueueDepth", "BitFlow frames on queue", NDAttrUInt32, &numItemsOnQueue);
 #else
-        unsigned int bufferID;
-        CiGetBufferID(hBoard_, wqe.frameID, &bufferID);
-        CiReleaseBuffer(hBoard_, bufferID);
+        epicsUInt32 frameID = pWqe->extraInfo.frameID;
+        epicsUInt64 hwTimeStamp = pWqe->extraInfo.timestamp;
+        pRaw->pAttributeList->add("BFFrameID", "BitFlow frame ID", NDAttrUInt32, &frameID);
+        pRaw->pAttributeList->add("BFTimeStamp", "BitFlow hardware time stamp", NDAttrUInt64, &hwTimeStamp);
+        addExtraInfoAttributes(pRaw->pAttributeList, pWqe->extraInfo);
 #endif
-        getIntegerParam(NDArrayCounter, &imageCounter);
-        getIntegerParam(ADNumImages, &numImages);
-        getIntegerParam(ADNumImagesCounter, &numImagesCounter);
-        getIntegerParam(ADImageMode, &imageMode);
-        getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
-        imageCounter++;
-        numImagesCounter++;
-        setIntegerParam(NDArrayCounter, imageCounter);
-        setIntegerParam(ADNumImagesCounter, numImagesCounter);
-
-        if (arrayCallbacks) {
-            // Call the NDArray callback
-            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s calling doCallbacksGenericPointer\n", driverName, functionName);
-            doCallbacksGenericPointer(pRaw, NDArrayData, 0);
-            // Release the NDArray buffer now that we are done with it.
-            // After the callback just above we don't need it anymore
-            //asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s releasing pRaw\n", driverName, functionName);
-            if (pRaw) pRaw->release();
-            pRaw = NULL;
-        }
-
-        // See if acquisition is done if we are in single or multiple mode
-        if ((imageMode == ADImageSingle) ||
-            ((imageMode == ADImageMultiple) && (numImagesCounter >= numImages))) {
-            setIntegerParam(ADStatus, ADStatusIdle);
-            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s::%s calling stopCapture\n", driverName, functionName);
-            stopCapture();
+        BF_TRACE_END(pTracer_, BFTraceAttributes, pWqe->uniqueId);
+    }
+
+    // Hand a frame to previewThread at BFPreviewRate.  The binning is done there at low priority,
+    // so only a reference, or a copy when there is no NDArray, is made here.
+    if (pData && previewDue()) {
+        NDArray *pPreviewArray = pRaw;
+        if (pRaw) {
+            pRaw->reserve();
+        } else {
+            // ArrayCallbacks is disabled, the DMA buffer is released below so it is copied
+            pPreviewArray = pPreview_->pNDArrayPool->alloc(nDims, dims, dataType, dataSize, NULL);
+            if (pPreviewArray) {
+                unlock();
+                memcpy(pPreviewArray->pData, pData, dataSize);
+                lock();
+                pPreviewArray->uniqueId = pWqe->uniqueId;
+                pPreviewArray->timeStamp = pWqe->arrivalTime.secPastEpoch + pWqe->arrivalTime.nsec/1e9;
+                pPreviewArray->epicsTS = pWqe->arrivalTime;
+            }
         }
-        t4 = epicsTime::getCurrent();
-        setDoubleParam(BFProcessTotalTime, (t4-t1)*1000.);
-        setDoubleParam(BFProcessCopyTime, (t3-t2)*1000.);
-        setIntegerParam(BFMessageQueueFree, messageQueueSize_ - pMsgQ_->pending());
+        if (pPreviewArray) {
+            // A frame previewThread has not started on yet is replaced by this one
+            if (pPreviewArray_) pPreviewArray_->release();
+            pPreviewArray_ = pPreviewArray;
+            epicsEventSignal(previewEventId_);
+        }
+    }
+
+    // Mark the buffer as available
+    BF_TRACE_BEGIN(pTracer_, BFTraceReleaseBuffer, pWqe->uniqueId);
+#ifdef _WIN32
+    pBoard_->setBufferStatus(cirHandle, BIAVAILABLE);
+#else
+    unsigned int bufferID;
+    CiGetBufferID(hBoard_, pWqe->frameID, &bufferID);
+    CiReleaseBuffer(hBoard_, bufferID);
+#endif
+    BF_TRACE_END(pTracer_, BFTraceReleaseBuffer, pWqe->uniqueId);
+    getIntegerParam(ADNumImages, &numImages);
+    getIntegerParam(ADImageMode, &imageMode);
+    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+    epicsAtomicIncrIntT(&arrayCounter_);
+    numImagesCounter = epicsAtomicIncrIntT(&numImagesCounter_);
+
+    if (arrayCallbacks) {
+        // Call the NDArray callback
+        BF_TRACE_BEGIN(pTracer_, BFTraceCallbacks, pWqe->uniqueId);
+        doCallbacksGenericPointer(pRaw, NDArrayData, 0);
+        BF_TRACE_END(pTracer_, BFTraceCallbacks, pWqe->uniqueId);
+        // Release the NDArray buffer now that we are done with it.
+        // After the callback just above we don't need it anymore
+        //asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s releasing pRaw\n", driverName, functionName);
+        if (pRaw) pRaw->release();
+        pRaw = NULL;
+    }
+
+    t4 = epicsTime::getCurrent();
+    processTotalTime_ = (t4-t1)*1000.;
+    processCopyTime_ = (t3-t2)*1000.;
+    // End-to-end latency from the wait thread receiving the frame to the callbacks being done
+    doneTime = t4;
+    pLatencyStats_->add(epicsTimeDiffInSeconds(&doneTime, &pWqe->arrivalTime)*1000.);
+#ifdef _WIN32
+    epicsAtomicSetIntT(&bufferQueueSize_, cirHandle.NumItemsOnQueue);
+#else
+    // Is this information available in Linux?
+#endif
+
+    // See if acquisition is done if we are in single or multiple mode
+    // stopCapture() flushes the final counter values
+    if ((imageMode == ADImageSingle) ||
+        ((imageMode == ADImageMultiple) && (numImagesCounter >= numImages))) {
+        setIntegerParam(ADStatus, ADStatusIdle);
+        BF_TRACE(pTracer_, BFTraceStopCapture, pWqe->uniqueId, numImagesCounter);
+        stopCapture();
+        callParamCallbacks();
+    }
+}
+
+/** Records the arrival of a frame for the stall watchdog.
+  * Called by waitImageThread with the lock held.
+  * \param[in] arrivalTime The time the wait thread received the frame.
+  */
+void ADBitFlow::frameArrived(epicsTimeStamp const & arrivalTime)
+{
+    static const char *functionName = "frameArrived";
+    double interval = epicsTimeDiffInSeconds(&arrivalTime, &lastFrameTime_);
+
+    // Running average of the interval between frames, which is the expected interval for the watchdog
+    if (frameInterval_ == 0.) {
+        frameInterval_ = interval;
+    } else {
+        frameInterval_ += (interval - frameInterval_)/16.;
+    }
+    lastFrameTime_ = arrivalTime;
+    if (startupTime_ == 0.) {
+        startupTime_ = epicsTimeDiffInSeconds(&arrivalTime, &createTime_);
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s first frame %.3f s after the driver was created, iocInit completed after %.3f s\n",
+            driverName, functionName, startupTime_, iocInitTime_);
+    }
+    if (stalled_) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s frames are arriving again\n",
+            driverName, functionName);
+        stalled_ = false;
+        setIntegerParam(BFStalled, 0);
+        callParamCallbacks();
+    }
+    // The restarted acquisition is running, an aborted status from now on is a real abort
+    recovering_ = false;
+}
+
+/** Checks whether frames have stopped arriving and optionally re-arms the acquisition.
+  * Acquisition is stalled when no frame has arrived for the larger of BFStallTimeout and
+  * BFStallFactor times the average frame interval.
+  * Called by waitImageThread with the lock held when a wait ends without a frame.
+  */
+void ADBitFlow::checkStall()
+{
+    static const char *functionName = "checkStall";
+    double stallTimeout, stallFactor, threshold, elapsed;
+    int stallRecovery;
+    epicsTimeStamp now;
+
+    getDoubleParam(BFStallTimeout, &stallTimeout);
+    if (stallTimeout <= 0.) return;
+    getDoubleParam(BFStallFactor, &stallFactor);
+    threshold = stallTimeout;
+    if (stallFactor*frameInterval_ > threshold) threshold = stallFactor*frameInterval_;
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &lastFrameTime_);
+    if (elapsed < threshold) return;
+    if (!stalled_) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s no frame for %.3f seconds, expected interval %.3f seconds\n",
+            driverName, functionName, elapsed, frameInterval_);
+        stalled_ = true;
+        setIntegerParam(BFStalled, 1);
+        featureEvent("Stall");
+        callParamCallbacks();
+    }
+    getIntegerParam(BFStallRecovery, &stallRecovery);
+    if (!stallRecovery) return;
+    recoverAcquisition();
+    // Give the restarted acquisition the full threshold before trying again
+    epicsTimeGetCurrent(&lastFrameTime_);
+}
+
+/** Re-arms a stalled acquisition: aborts it, re-configures the DMA buffers and restarts it.
+  * Called by waitImageThread with the lock held.  The lock is released while waiting for the workers
+  * to finish with the frames they hold, for at most 1 second.
+  */
+asynStatus ADBitFlow::recoverAcquisition()
+{
+    static const char *functionName = "recoverAcquisition";
+    asynStatus status;
+    int recoveries;
+
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s re-arming acquisition\n",
+        driverName, functionName);
+    recovering_ = true;
+#ifdef _WIN32
+    pBoard_->cirControl(BIABORT, BiAsync);
+#else
+    CiAqAbort(hBoard_);
+#endif
+    // The buffers are freed when they are re-configured, so the workers must be done with them
+    unlock();
+    for (int i=0; i<100; i++) {
+        if ((pMsgQ_->pending() == 0) && (epicsAtomicGetIntT(&framesInFlight_) == 0)) break;
+        epicsThreadSleep(0.01);
+    }
+    lock();
+    if (!epicsAtomicGetIntT(&acquiring_)) return asynSuccess;
+    if ((pMsgQ_->pending() != 0) || (epicsAtomicGetIntT(&framesInFlight_) != 0)) {
+        // setROI() would free the DMA buffers while a worker is still copying from them
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s %d frames still being processed, recovery abandoned and acquisition stopped\n",
+            driverName, functionName, epicsAtomicGetIntT(&framesInFlight_));
+        stopCapture();
+        setIntegerParam(ADStatus, ADStatusError);
+        callParamCallbacks();
+        return asynError;
+    }
+    GenICamFeature *acquisitionStop = mGCFeatureSet.getByName("AcquisitionStop");
+    acquisitionStop->writeCommand();
+    status = setROI();
+    if (status) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error re-configuring buffers, acquisition stopped\n",
+            driverName, functionName);
+        stopCapture();
+        setIntegerParam(ADStatus, ADStatusError);
+        callParamCallbacks();
+        return status;
+    }
+    GenICamFeature *acquisitionStart = mGCFeatureSet.getByName("AcquisitionStart");
+    acquisitionStart->writeCommand();
 #ifdef _WIN32
-        setIntegerParam(BFBufferQueueSize, cirHandle.NumItemsOnQueue);
+    pBoard_->cirControl(BISTART, BiAsync);
 #else
-        // Is this information available in Linux?
+    CiAqStart(hBoard_, -1);
 #endif
+    getIntegerParam(BFRecoveries, &recoveries);
+    setIntegerParam(BFRecoveries, recoveries+1);
+    callParamCallbacks();
+    return asynSuccess;
+}
+
+/** Copies the per-frame counters and timing into the parameter library.
+  * Must be called with the lock held; the caller is responsible for calling callParamCallbacks().
+  */
+void ADBitFlow::updateStatus()
+{
+    setIntegerParam(NDArrayCounter, epicsAtomicGetIntT(&arrayCounter_));
+    setIntegerParam(ADNumImagesCounter, epicsAtomicGetIntT(&numImagesCounter_));
+    setIntegerParam(BFBufferQueueSize, epicsAtomicGetIntT(&bufferQueueSize_));
+    setIntegerParam(BFMessageQueueFree, messageQueueSize_ - pMsgQ_->pending());
+    setDoubleParam(BFProcessTotalTime, processTotalTime_);
+    setDoubleParam(BFProcessCopyTime, processCopyTime_);
+    setDoubleParam(BFFrameInterval, frameInterval_*1000.);
+}
+
+/** Copies the statistics into the parameter library: percentiles, clock model, memory, feature cache
+  * and control channel.  These cost more than the per-frame counters, so statusThread only calls this
+  * every statisticsPeriod seconds, and ReadStatus and BFControlReset call it on demand.
+  * Must be called with the lock held; the caller is responsible for calling callParamCallbacks().
+  */
+void ADBitFlow::updateStatistics()
+{
+    setIntegerParam(BFClockSamples, pClockModel_->getNumSamples());
+    setDoubleParam(BFClockFrequency, pClockModel_->getFrequency());
+    setDoubleParam(BFClockResidual, pClockModel_->getResidual()*1e6);
+    double p50, p99, max;
+    pLatencyStats_->getPercentiles(&p50, &p99, &max);
+    setDoubleParam(BFLatencyP50, p50);
+    setDoubleParam(BFLatencyP99, p99);
+    setDoubleParam(BFLatencyMax, max);
+    int numArrays;
+    double ring, slab, queue, preview, total;
+    getIntegerParam(BFPreallocArrays, &numArrays);
+    total = computeMemory(numBFBuffers_, numArrays, &ring, &slab, &queue, &preview);
+    setDoubleParam(BFMemoryRing, ring/1e6);
+    setDoubleParam(BFMemorySlab, slab/1e6);
+    setDoubleParam(BFMemoryQueue, queue/1e6);
+    setDoubleParam(BFMemoryPreview, preview/1e6);
+    setDoubleParam(BFMemoryTotal, total/1e6);
+    setDoubleParam(BFMemoryPool, pNDArrayPool->getMemorySize()/1e6);
+    setIntegerParam(BFFeatureCacheHits, pFeatureCache_->getHits());
+    setIntegerParam(BFFeatureCacheMisses, pFeatureCache_->getMisses());
+    setIntegerParam(BFNodesResolved, nodesResolved_);
+    setDoubleParam(BFNodeResolveTime, nodeResolveTime_);
+    setDoubleParam(BFStartupTime, startupTime_);
+    setIntegerParam(BFWritesPending, (int)writeQueue_.size() + (writeBusy_ ? 1 : 0));
+    setIntegerParam(BFWritesCoalesced, writesCoalesced_);
+    pWriteLatency_->getPercentiles(&p50, &p99, &max);
+    setDoubleParam(BFWriteLatencyP50, p50);
+    setDoubleParam(BFWriteLatencyP99, p99);
+    setDoubleParam(BFWriteLatencyMax, max);
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    int controlReads = pControlStats_->getReads();
+    int controlWrites = pControlStats_->getWrites();
+    double controlInterval = epicsTimeDiffInSeconds(&now, &controlRateTime_);
+    if (controlInterval > 0.) {
+        setDoubleParam(BFControlRate, (controlReads + controlWrites - controlTransactions_) / controlInterval);
+    }
+    controlTransactions_ = controlReads + controlWrites;
+    controlRateTime_ = now;
+    setIntegerParam(BFControlReads, controlReads);
+    setIntegerParam(BFControlWrites, controlWrites);
+    setDoubleParam(BFControlTime, pControlStats_->getTime());
+    pControlStats_->getReadPercentiles(&p50, &p99, &max);
+    setDoubleParam(BFControlReadP99, p99);
+    pControlStats_->getWritePercentiles(&p50, &p99, &max);
+    setDoubleParam(BFControlWriteP99, p99);
+    std::vector<BFFeature *> top;
+    std::string topString;
+    char buffer[128];
+    topFeatures(5, top);
+    pControlStats_->lock();
+    for (size_t i=0; i<top.size(); i++) {
+        BFNodeStats & stats = top[i]->getNodeStats();
+        epicsSnprintf(buffer, sizeof(buffer), "%s%s %.1f ms", i ? ", " : "",
+                      top[i]->getFeatureName().c_str(), (stats.readTime + stats.writeTime)*1000.);
+        topString += buffer;
+    }
+    pControlStats_->unlock();
+    setStringParam(BFControlTop, topString);
+    // The arrival jitter is relative to the earliest frame seen with the same strategy
+    int jitterP50[3] = {BFArrivalJitterBlockingP50, BFArrivalJitterBusyPollP50, BFArrivalJitterHybridP50};
+    int jitterP99[3] = {BFArrivalJitterBlockingP99, BFArrivalJitterBusyPollP99, BFArrivalJitterHybridP99};
+    for (int i=0; i<3; i++) {
+        double minDelay = pArrivalJitter_[i]->getMin();
+        pArrivalJitter_[i]->getPercentiles(&p50, &p99, &max);
+        setDoubleParam(jitterP50[i], (p50 - minDelay)*1e6);
+        setDoubleParam(jitterP99[i], (p99 - minDelay)*1e6);
+    }
+}
+
+/** Task to publish the counters and timing at BFStatusUpdateRate.
+  * This replaces calling callParamCallbacks() for every frame, which at high frame rates
+  * costs more than processing the frame.
+  */
+void ADBitFlow::statusThread()
+{
+    double updateRate;
+    epicsTimeStamp now;
+
+    lock();
+    while (!exiting_) {
+        getDoubleParam(BFStatusUpdateRate, &updateRate);
+        if (updateRate < 0.1) updateRate = 0.1;
+        unlock();
+        epicsEventWaitWithTimeout(statusEventId_, 1./updateRate);
+        lock();
+        updateStatus();
+        epicsTimeGetCurrent(&now);
+        if (epicsTimeDiffInSeconds(&now, &statisticsTime_) >= statisticsPeriod) {
+            updateStatistics();
+            statisticsTime_ = now;
+        }
+        adjustWorkers();
+        callParamCallbacks();
+    }
+    unlock();
+}
+
+/** Task to read the GenICam features according to their polling class.
+  * The due features are selected with the lock held, read from the camera without the lock,
+  * and the values are then written to the parameter library with one lock acquisition and
+  * one callParamCallbacks().
+  */
+void ADBitFlow::pollThread()
+{
+    int enable;
+    double fastPeriod, slowPeriod;
+    std::vector<BFFeature *> due;
+    std::vector<BFFeatureValue> values;
+    std::vector<bool> valid;
+    epicsTimeStamp now, endTime;
+
+    lock();
+    while (!exiting_) {
+        getIntegerParam(BFPollEnable, &enable);
+        getDoubleParam(BFPollFastPeriod, &fastPeriod);
+        getDoubleParam(BFPollSlowPeriod, &slowPeriod);
+        if (fastPeriod < 0.01) fastPeriod = 0.01;
+        unlock();
+        // BFPollOnChange features are picked up on the next fast period after a write
+        epicsEventWaitWithTimeout(pollEventId_, fastPeriod);
+        lock();
+        if (exiting_) continue;
+        epicsTimeGetCurrent(&now);
+        due.clear();
+        // Features attached to a driver event are read when it occurs even if polling is disabled
+        for (size_t i=0; i<features_.size(); i++) {
+            if (features_[i]->eventDue() || (enable && features_[i]->pollDue(now, slowPeriod, fastPeriod))) {
+                due.push_back(features_[i]);
+            }
+        }
+        if (due.empty()) continue;
+        for (size_t i=0; i<due.size(); i++) due[i]->beginOffLock();
+        unlock();
+        values.resize(due.size());
+        valid.resize(due.size());
+        for (size_t i=0; i<due.size(); i++) {
+            valid[i] = due[i]->poll(values[i]);
+        }
+        lock();
+        for (size_t i=0; i<due.size(); i++) {
+            due[i]->endOffLock();
+            if (valid[i]) due[i]->deliver(values[i]);
+        }
+        epicsTimeGetCurrent(&endTime);
+        setIntegerParam(BFPollCount, (int)due.size());
+        setDoubleParam(BFPollTime, epicsTimeDiffInSeconds(&endTime, &now)*1000.);
+        callParamCallbacks();
+    }
+    unlock();
+}
+
+/** Queues a feature write for controlThread.
+  * Returns false if the caller must write the value itself: asynchronous writes are disabled, or the
+  * write is a command.  Commands such as AcquisitionStart are executed synchronously by the caller
+  * after the queued writes have completed, so that they see the camera in the state the queue leaves it.
+  * A write to a feature that already has a write waiting in the queue replaces it.  The old entry is
+  * removed and the new one appended, so that the writes still run in the order of their last request.
+  * Called with the lock held.
+  */
+bool ADBitFlow::queueWrite(BFFeature *pFeature, BFWriteType_t type, BFFeatureValue const & value)
+{
+    int asyncWrites;
+
+    getIntegerParam(BFAsyncWrites, &asyncWrites);
+    if (!asyncWrites || (type == BFWriteCommand)) {
+        flushWrites();
+        return false;
+    }
+    for (std::deque<BFPendingWrite>::iterator it=writeQueue_.begin(); it!=writeQueue_.end(); ++it) {
+        if (it->pFeature == pFeature) {
+            writeQueue_.erase(it);
+            writesCoalesced_++;
+            break;
+        }
+    }
+    BFPendingWrite write;
+    write.pFeature = pFeature;
+    write.type = type;
+    write.value = value;
+    epicsTimeGetCurrent(&write.queueTime);
+    writeQueue_.push_back(write);
+    epicsEventSignal(writeEventId_);
+    return true;
+}
+
+/** Records the latency of a feature write, from being queued (or started if not queued) to completion */
+void ADBitFlow::writeDone(double seconds)
+{
+    pWriteLatency_->add(seconds*1000.);
+}
+
+/** Waits for the queued feature writes to complete.  Called with the lock held. */
+void ADBitFlow::flushWrites()
+{
+    while ((!writeQueue_.empty() || writeBusy_) && !exiting_) {
+        unlock();
+        epicsEventWaitWithTimeout(writeDoneEventId_, 0.1);
+        lock();
+    }
+}
+
+/** Task to execute the queued feature writes.
+  * BFGTLNodeWrite is called without the lock so that a slow camera write does not block other
+  * PV traffic or the image processing threads.  When the write completes the feature is read back
+  * into the parameter library, which is the completion notification for clients.
+  */
+void ADBitFlow::controlThread()
+{
+    BFPendingWrite write;
+    epicsTimeStamp doneTime;
+
+    lock();
+    while (!exiting_) {
+        if (writeQueue_.empty()) {
+            unlock();
+            epicsEventWait(writeEventId_);
+            lock();
+            continue;
+        }
+        write = writeQueue_.front();
+        writeQueue_.pop_front();
+        writeBusy_ = true;
+        write.pFeature->beginOffLock();
+        unlock();
+        write.pFeature->performWrite(write.type, write.value);
+        epicsTimeGetCurrent(&doneTime);
+        lock();
+        write.pFeature->endOffLock();
+        writeBusy_ = false;
+        pFeatureCache_->invalidate();
+        writeDone(epicsTimeDiffInSeconds(&doneTime, &write.queueTime));
+        write.pFeature->read(NULL, true);
         callParamCallbacks();
+        epicsEventSignal(writeDoneEventId_);
+    }
+    unlock();
+}
+
+/** Sets the polling class of a feature.
+  * \param[in] featureName The GenICam feature name, e.g. "DeviceTemperature"
+  * \param[in] pollClass One of "never", "static", "slow", "fast", "onchange" or "auto"
+  */
+asynStatus ADBitFlow::setPollClass(const char *featureName, const char *pollClass)
+{
+    static const char *functionName = "setPollClass";
+    static const char *classNames[] = {"never", "static", "slow", "fast", "onchange"};
+    int value = BFPollAuto;
+
+    for (int i=0; i<(int)(sizeof(classNames)/sizeof(classNames[0])); i++) {
+        if (epicsStrCaseCmp(pollClass, classNames[i]) == 0) value = i;
+    }
+    if ((value == BFPollAuto) && (epicsStrCaseCmp(pollClass, "auto") != 0)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s unknown polling class %s\n",
+            driverName, functionName, pollClass);
+        return asynError;
+    }
+    lock();
+    pollClasses_[featureName] = value;
+    for (size_t i=0; i<features_.size(); i++) {
+        if (features_[i]->getFeatureName() == featureName) {
+            features_[i]->setPollClass((BFPollClass_t)value);
+        }
+    }
+    unlock();
+    return asynSuccess;
+}
+
+/** Names of the events the driver raises with featureEvent() */
+static const char *featureEventNames[] = {"AcquisitionStart", "AcquisitionEnd", "Stall"};
+/** Prefix of the GenTL device events delivered by BFDeviceEvents, followed by the event ID */
+static const char *deviceEventPrefix = "Device:";
+
+/** Attaches a feature to a driver or camera event, pollThread reads the feature when the event occurs.
+  * Together with the "never" polling class this replaces periodic polling of features that only
+  * change at known points, e.g. AcquisitionStatus or a frame counter read at the end of acquisition.
+  * \param[in] eventName One of "AcquisitionStart", "AcquisitionEnd" or "Stall", or "Device:<id>" for the
+  *            camera event with that event ID, e.g. "Device:0x10" (see ADBitFlowDeviceEvents)
+  * \param[in] featureName The GenICam feature name
+  */
+asynStatus ADBitFlow::subscribeEvent(const char *eventName, const char *featureName)
+{
+    static const char *functionName = "subscribeEvent";
+    bool known = false;
+    char deviceEventName[32];
+
+    for (size_t i=0; i<sizeof(featureEventNames)/sizeof(featureEventNames[0]); i++) {
+        if (strcmp(eventName, featureEventNames[i]) == 0) known = true;
+    }
+    size_t prefixLen = strlen(deviceEventPrefix);
+    if (!known && (strncmp(eventName, deviceEventPrefix, prefixLen) == 0)) {
+        // Device event IDs can be given in decimal or hex, they are delivered as hex
+        char *end;
+        unsigned long id = strtoul(eventName + prefixLen, &end, 0);
+        if ((end != eventName + prefixLen) && (*end == 0)) {
+            epicsSnprintf(deviceEventName, sizeof(deviceEventName), "%s0x%lx", deviceEventPrefix, id);
+            eventName = deviceEventName;
+            known = true;
+        }
     }
+    if (!known) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s unknown event %s\n",
+            driverName, functionName, eventName);
+        return asynError;
+    }
+    lock();
+    eventFeatures_.insert(std::make_pair(std::string(eventName), std::string(featureName)));
+    unlock();
+    return asynSuccess;
+}
+
+/** Marks the features attached to eventName for reading and wakes up pollThread.  Called with the lock held. */
+void ADBitFlow::featureEvent(const char *eventName)
+{
+    typedef std::multimap<std::string, std::string>::iterator eventIterator;
+    std::pair<eventIterator, eventIterator> range = eventFeatures_.equal_range(eventName);
+
+    if (range.first == range.second) return;
+    for (size_t i=0; i<features_.size(); i++) {
+        for (eventIterator it=range.first; it!=range.second; ++it) {
+            if (features_[i]->getFeatureName() == it->second) features_[i]->setEventPending();
+        }
+    }
+    featureEvents_++;
+    setIntegerParam(BFFeatureEvents, featureEvents_);
+    epicsEventSignal(pollEventId_);
+}
+
+/** Opens the camera through the GenTL producer and starts delivering its events.
+  * Device events read the features attached to "Device:<id>" with ADBitFlowFeatureEvent.  A feature
+  * invalidation expires the cached node attributes and reads the invalidated feature.
+  * \param[in] ctiFile Path of the producer's CTI file, empty to use the BitFlow producer
+  * \param[in] interfaceIndex GenTL interface of the camera, -1 for the board number
+  * \param[in] deviceIndex Device on the interface
+  */
+asynStatus ADBitFlow::startDeviceEvents(const char *ctiFile, int interfaceIndex, int deviceIndex)
+{
+    if (!pDeviceEvents_) pDeviceEvents_ = new BFDeviceEvents(this);
+    if (interfaceIndex < 0) interfaceIndex = boardNum_;
+    return pDeviceEvents_->start(ctiFile, interfaceIndex, deviceIndex) ? asynError : asynSuccess;
+}
+
+/** Called by the BFDeviceEvents thread without the lock when the camera sends an event */
+void ADBitFlow::deviceEvent(const char *eventName)
+{
+    lock();
+    featureEvent(eventName);
+    callParamCallbacks();
+    unlock();
+}
+
+/** Called by the BFDeviceEvents thread without the lock when the producer invalidates a feature */
+void ADBitFlow::featureInvalidated(const char *featureName)
+{
+    lock();
+    pFeatureCache_->invalidate();
+    for (size_t i=0; i<features_.size(); i++) {
+        if (features_[i]->getFeatureName() == featureName) features_[i]->setEventPending();
+    }
+    epicsEventSignal(pollEventId_);
+    unlock();
 }
 
 asynStatus ADBitFlow::writeInt32(asynUser *pasynUser, epicsInt32 value)
@@ -678,6 +2229,87 @@ asynStatus ADBitFlow::writeInt32(asynUser *pasynUser, epicsInt32 value)
     static const char *functionName = "writeInt32";
   
     this->getAddress(pasynUser, &addr);
+    if (function == NDArrayCounter) {
+        // The counter is maintained by the worker threads, statusThread copies it to the parameter
+        epicsAtomicSetIntT(&arrayCounter_, value);
+    }
+    else if (function == BFClockWindow) {
+        pClockModel_->setWindowSize(value);
+        pJitterModel_->setWindowSize(value);
+    }
+    else if (function == ADReadStatus) {
+        // ADGenICam would read every feature here with the lock held, pollThread reads them without it
+        for (size_t i=0; i<features_.size(); i++) {
+            features_[i]->setEventPending();
+        }
+        epicsEventSignal(pollEventId_);
+        updateStatus();
+        updateStatistics();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    else if (function == BFPollEnable) {
+        setIntegerParam(function, value);
+        epicsEventSignal(pollEventId_);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    else if (function == BFAsyncWrites) {
+        setIntegerParam(function, value);
+        if (!value) flushWrites();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    else if (function == BFControlReset) {
+        pControlStats_->lock();
+        for (size_t i=0; i<features_.size(); i++) {
+            features_[i]->getNodeStats() = BFNodeStats();
+        }
+        pControlStats_->unlock();
+        pControlStats_->reset();
+        controlTransactions_ = 0;
+        updateStatistics();
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    else if ((function == BFConfigSave) || (function == BFConfigRestore)) {
+        std::string fileName;
+        asynStatus status;
+        getStringParam(BFConfigFile, fileName);
+        setIntegerParam(function, 1);
+        callParamCallbacks();
+        if (function == BFConfigSave) status = saveConfig(fileName.c_str());
+        else                          status = restoreConfig(fileName.c_str());
+        setIntegerParam(function, 0);
+        callParamCallbacks();
+        return status;
+    }
+    else if (function == BFBufferSize) {
+        asynStatus status = setBufferSize(value);
+        callParamCallbacks();
+        return status;
+    }
+    else if (function == BFMemoryPolicy) {
+        asynStatus status;
+        setIntegerParam(function, value);
+        status = fitBufferSize();
+        callParamCallbacks();
+        return status;
+    }
+    else if ((function == BFMinWorkers) || (function == BFMaxWorkers)) {
+        // statusThread moves the pool into the new range
+        int minWorkers, maxWorkers;
+        if (value < 1) value = 1;
+        if (value > maxWorkerThreads) value = maxWorkerThreads;
+        setIntegerParam(function, value);
+        getIntegerParam(BFMinWorkers, &minWorkers);
+        getIntegerParam(BFMaxWorkers, &maxWorkers);
+        if (minWorkers > maxWorkers) {
+            setIntegerParam((function == BFMinWorkers) ? BFMaxWorkers : BFMinWorkers, value);
+        }
+        callParamCallbacks();
+        return asynSuccess;
+    }
     if ((function == ADSizeX) ||
         (function == ADSizeY) ||
         (function == ADMinX)  ||
@@ -689,6 +2321,39 @@ asynStatus ADBitFlow::writeInt32(asynUser *pasynUser, epicsInt32 value)
     return ADGenICam::writeInt32(pasynUser, value);
 }
 
+asynStatus ADBitFlow::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+
+    if (function == BFStatusUpdateRate) {
+        setDoubleParam(function, value);
+        // Wake up statusThread so the new rate takes effect immediately
+        epicsEventSignal(statusEventId_);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    else if ((function == BFPollFastPeriod) || (function == BFPollSlowPeriod)) {
+        setDoubleParam(function, value);
+        epicsEventSignal(pollEventId_);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    else if (function == BFMemoryBudget) {
+        asynStatus status;
+        setDoubleParam(function, value);
+        status = fitBufferSize();
+        callParamCallbacks();
+        return status;
+    }
+    else if (function == BFFeatureCacheAge) {
+        setDoubleParam(function, value);
+        pFeatureCache_->setMaxAge(value);
+        callParamCallbacks();
+        return asynSuccess;
+    }
+    return ADGenICam::writeFloat64(pasynUser, value);
+}
+
 asynStatus ADBitFlow::setROI() 
 {
     int minX, minY, sizeX, sizeY;
@@ -705,6 +2370,8 @@ asynStatus ADBitFlow::setROI()
         pBoard_->cleanup();
         pBoard_->setAcqROI(minX, minY, sizeX, sizeY);
         pBoard_->setup(numBFBuffers_, errorMode, cirSetupOptions);
+        setIntegerParam(BFBufferSize, numBFBuffers_);
+        setDoubleParam(BFBufferBytes, (double)numBFBuffers_ * pBoard_->getBrdInfo(BiCamInqFrameSize0));
     }
     catch (BFException e) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error calling setAcqROI error=%s\n",
@@ -732,18 +2399,419 @@ asynStatus ADBitFlow::setROI()
     setIntegerParam(ADSizeX, hROIsize);    
     setIntegerParam(ADSizeY, vROIsize);
     bitsPerPixel_ = bitsPerPix;
+    bufferBytes_ = (double)stride * vROIsize;
+    setIntegerParam(BFBufferSize, nFrames);
+    setDoubleParam(BFBufferBytes, (double)nFrames * stride * vROIsize);
+#endif
+    return asynSuccess;
+}
+
+/** Returns the size in bytes of one frame with the current ROI and pixel format */
+double ADBitFlow::getFrameBytes()
+{
+#ifdef _WIN32
+    return pBoard_->getBrdInfo(BiCamInqFrameSize0);
+#else
+    int sizeX, sizeY;
+    getIntegerParam(ADSizeX, &sizeX);
+    getIntegerParam(ADSizeY, &sizeY);
+    return (double)sizeX * sizeY * bitsPerPixel_/8;
+#endif
+}
+
+/** Returns the size in bytes of one DMA buffer, which is larger than the frame if the rows are padded */
+double ADBitFlow::getBufferBytes()
+{
+#ifdef _WIN32
+    return pBoard_->getBrdInfo(BiCamInqFrameSize0);
+#else
+    return bufferBytes_;
+#endif
+}
+
+/** Returns true if a preview should be made from the current frame.
+  * Only one frame per 1/BFPreviewRate seconds is selected, even when several workers ask at the same time.
+  * Called with the lock held.
+  */
+bool ADBitFlow::previewDue()
+{
+    int enable;
+    double rate;
+    epicsTimeStamp now;
+
+    getIntegerParam(BFPreviewEnable, &enable);
+    if (!enable) return false;
+    getDoubleParam(BFPreviewRate, &rate);
+    if (rate <= 0.) return false;
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &lastPreviewTime_) < 1./rate) return false;
+    lastPreviewTime_ = now;
+    return true;
+}
+
+/** Task to publish the previews.  processFrame() hands it one frame at a time, which is binned into
+  * the preview port here, off the path of the frames at full rate.
+  */
+void ADBitFlow::previewThread()
+{
+    NDArray *pArray;
+    int binning, preview8Bit, shift, pixelSize, previewCounter;
+    asynStatus status;
+
+    lock();
+    while (!exiting_) {
+        if (!pPreviewArray_) {
+            unlock();
+            epicsEventWait(previewEventId_);
+            lock();
+            continue;
+        }
+        pArray = pPreviewArray_;
+        pPreviewArray_ = 0;
+        pixelSize = (pArray->dataType == NDUInt16) ? 2 : 1;
+        getIntegerParam(BFPreviewBinning, &binning);
+        getIntegerParam(BFPreview8Bit, &preview8Bit);
+        getIntegerParam(BFPreviewShift, &shift);
+        if (!preview8Bit) {
+            shift = -1;
+        } else if (shift < 0) {
+            // Automatic, keep the most significant 8 bits
+#ifdef _WIN32
+            shift = pixelSize*8 - 8;
+#else
+            shift = bitsPerPixel_ - 8;
 #endif
+            if (shift < 0) shift = 0;
+        }
+        unlock();
+        status = asynError;
+        if (pArray->ndims == 2) {
+            status = pPreview_->publish(pArray->pData, pArray->dims[0].size, pArray->dims[1].size, pixelSize,
+                                        binning, shift, pArray->uniqueId, pArray->timeStamp, pArray->epicsTS);
+        }
+        pArray->release();
+        lock();
+        if (status == asynSuccess) {
+            getIntegerParam(BFPreviewCounter, &previewCounter);
+            setIntegerParam(BFPreviewCounter, previewCounter+1);
+        }
+    }
+    if (pPreviewArray_) pPreviewArray_->release();
+    pPreviewArray_ = 0;
+    unlock();
+}
+
+/** Computes the memory the acquisition needs with the current ROI and pixel format.
+  * \param[in] numBuffers Number of DMA buffers.
+  * \param[in] numArrays Number of NDArrays preallocated when acquisition starts.
+  * \param[out] ring Bytes of the DMA ring.
+  * \param[out] slab Bytes of the preallocated NDArrays.
+  * \param[out] queue Bytes of the dispatch queue and of the NDArrays the workers are filling.
+  * \param[out] preview Bytes of the preview port's pool, its bound when the preview is enabled.
+  * \return The total in bytes.
+  */
+double ADBitFlow::computeMemory(int numBuffers, int numArrays, double *ring, double *slab, double *queue, double *preview)
+{
+    double frameBytes = getFrameBytes();
+    int previewEnable;
+
+    *ring = numBuffers * getBufferBytes();
+    *slab = numArrays * frameBytes;
+    // The dispatch queue has one entry per DMA buffer
+    *queue = (double)numBuffers * sizeof(workerQueueElement) + numWorkers_ * frameBytes;
+    // A disabled preview keeps the arrays it already allocated
+    getIntegerParam(BFPreviewEnable, &previewEnable);
+    *preview = (double)(previewEnable ? pPreview_->pNDArrayPool->getMaxMemory() : pPreview_->pNDArrayPool->getMemorySize());
+    return *ring + *slab + *queue + *preview;
+}
+
+/** Checks the memory the acquisition needs against BFMemoryBudget.
+  * With BFMemoryPolicy=Downsize an acquisition over the budget preallocates fewer NDArrays.
+  * The number of DMA buffers is not changed here, because that restarts the workers after ADAcquire
+  * has been set, fitBufferSize() does that while idle.  If the acquisition does not fit it is refused.
+  * Called by startCapture() with the lock held.
+  */
+asynStatus ADBitFlow::checkMemoryBudget()
+{
+    static const char *functionName = "checkMemoryBudget";
+    double budget, ring, slab, queue, preview, total;
+    double frameBytes = getFrameBytes();
+    int policy, numArrays;
+
+    getDoubleParam(BFMemoryBudget, &budget);
+    if (budget <= 0.) return asynSuccess;
+    budget *= 1e6;
+    getIntegerParam(BFMemoryPolicy, &policy);
+    getIntegerParam(BFPreallocArrays, &numArrays);
+    total = computeMemory(numBFBuffers_, numArrays, &ring, &slab, &queue, &preview);
+    if (total <= budget) return asynSuccess;
+    if ((policy == MemoryDownsize) && (frameBytes > 0.) && (numArrays > 0)) {
+        int fit = (int)((budget - ring - queue - preview)/frameBytes);
+        if (fit < 0) fit = 0;
+        if (fit < numArrays) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s memory budget exceeded, preallocating %d NDArrays instead of %d\n",
+                driverName, functionName, fit, numArrays);
+            numArrays = fit;
+            setIntegerParam(BFPreallocArrays, numArrays);
+        }
+        total = computeMemory(numBFBuffers_, numArrays, &ring, &slab, &queue, &preview);
+        if (total <= budget) return asynSuccess;
+    }
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s acquisition needs %.1f MB, more than the memory budget of %.1f MB\n",
+        driverName, functionName, total/1e6, budget/1e6);
+    setStringParam(ADStatusMessage, "Memory budget exceeded");
+    return asynError;
+}
+
+/** With BFMemoryPolicy=Downsize reduces the number of DMA buffers so that the ring fits in BFMemoryBudget,
+  * down to the minimum of 10.  The preallocated NDArrays are not counted, checkMemoryBudget() reduces those
+  * first when acquisition starts.
+  * Called with the lock held when BFMemoryBudget or BFMemoryPolicy is written.  Nothing is changed while acquiring.
+  */
+asynStatus ADBitFlow::fitBufferSize()
+{
+    static const char *functionName = "fitBufferSize";
+    double budget, ring, slab, queue, preview;
+    double bufferBytes = getBufferBytes();
+    int policy, fit;
+
+    getDoubleParam(BFMemoryBudget, &budget);
+    getIntegerParam(BFMemoryPolicy, &policy);
+    if ((budget <= 0.) || (policy != MemoryDownsize) || (bufferBytes <= 0.)) return asynSuccess;
+    if (epicsAtomicGetIntT(&acquiring_) || stopping_) return asynSuccess;
+    budget *= 1e6;
+    if (computeMemory(numBFBuffers_, 0, &ring, &slab, &queue, &preview) <= budget) return asynSuccess;
+    fit = (int)((budget - queue - preview)/bufferBytes);
+    if ((fit < 10) || (fit >= numBFBuffers_)) return asynSuccess;
+    asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+        "%s::%s memory budget exceeded, using %d DMA buffers instead of %d\n",
+        driverName, functionName, fit, numBFBuffers_);
+    return setBufferSize(fit);
+}
+
+/** Changes the number of DMA buffers and the size of the dispatch queue.
+  * This is only allowed while acquisition is idle and no frames are being processed.
+  * The buffers must fit in maxMemory if it is not 0.
+  * \param[in] numBuffers The new number of buffers, at least 10.
+  */
+asynStatus ADBitFlow::setBufferSize(int numBuffers)
+{
+    static const char *functionName = "setBufferSize";
+    int oldNumBuffers = numBFBuffers_;
+    asynStatus status;
+
+    if (numBuffers < 10) numBuffers = 10;
+    if (epicsAtomicGetIntT(&acquiring_) || (pMsgQ_->pending() > 0) || epicsAtomicGetIntT(&framesInFlight_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot change the number of buffers while acquiring\n",
+            driverName, functionName);
+        setIntegerParam(BFBufferSize, oldNumBuffers);
+        return asynError;
+    }
+    double bytes = numBuffers * getBufferBytes();
+    if ((maxMemory_ > 0) && (bytes > maxMemory_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s %d buffers need %.0f bytes, more than maxMemory=%lu\n",
+            driverName, functionName, numBuffers, bytes, (unsigned long)maxMemory_);
+        setIntegerParam(BFBufferSize, oldNumBuffers);
+        return asynError;
+    }
+    int numArrays;
+    double budget, ring, slab, queue, preview;
+    getDoubleParam(BFMemoryBudget, &budget);
+    getIntegerParam(BFPreallocArrays, &numArrays);
+    if ((budget > 0.) && (computeMemory(numBuffers, numArrays, &ring, &slab, &queue, &preview) > budget*1e6)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s %d buffers exceed the memory budget of %.1f MB\n",
+            driverName, functionName, numBuffers, budget);
+        setIntegerParam(BFBufferSize, oldNumBuffers);
+        return asynError;
+    }
+    numBFBuffers_ = numBuffers;
+    status = setROI();
+    if (status) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error allocating %d buffers, restoring %d\n",
+            driverName, functionName, numBuffers, oldNumBuffers);
+        numBFBuffers_ = oldNumBuffers;
+        setROI();
+        return status;
+    }
+    status = resizeMessageQueue(numBFBuffers_);
+    if (status) {
+        // The old queue is kept, so the ring must not be deeper than it
+        numBFBuffers_ = oldNumBuffers;
+        setROI();
+        return status;
+    }
     return asynSuccess;
 }
 
+/** Replaces the dispatch queue with one of a new size.
+  * The workers are blocked in receive() on the old queue, so they are asked to exit and are restarted
+  * on the new queue.  Called with the lock held and acquisition idle, the lock is released while
+  * the workers exit.
+  * \return asynError if a worker did not exit.  The old queue and the workers that are still running are kept.
+  */
+asynStatus ADBitFlow::resizeMessageQueue(int size)
+{
+    static const char *functionName = "resizeMessageQueue";
+    struct workerQueueElement wqe;
+    int numWorkers = numWorkers_;
+    asynStatus status = asynSuccess;
+
+    resizing_ = true;
+    memset(&wqe, 0, sizeof(wqe));
+    wqe.uniqueId = workerExitId;
+    unlock();
+    for (int i=0; i<numWorkers; i++) {
+        pMsgQ_->send(&wqe, sizeof(wqe));
+    }
+    for (int i=0; (i<500) && (epicsAtomicGetIntT(&workersRunning_) > 0); i++) {
+        epicsThreadSleep(0.01);
+    }
+    lock();
+    numWorkers_ = 0;
+    if (epicsAtomicGetIntT(&workersRunning_) > 0) {
+        // A worker did not exit, keep the old queue rather than deleting it under the worker.
+        // The exit requests that were not received are taken back, those workers stay in the pool.
+        while (pMsgQ_->tryReceive(&wqe, sizeof(wqe)) >= 0) {
+            numWorkers_++;
+        }
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s workers did not exit, keeping message queue size %d\n",
+            driverName, functionName, messageQueueSize_);
+        status = asynError;
+    } else {
+        delete pMsgQ_;
+        messageQueueSize_ = size;
+        pMsgQ_ = new epicsMessageQueue(messageQueueSize_, sizeof(workerQueueElement));
+        for (int i=0; i<numWorkers; i++) {
+            startWorker();
+        }
+    }
+    setIntegerParam(BFMessageQueueSize, messageQueueSize_);
+    setIntegerParam(BFMessageQueueFree, messageQueueSize_ - pMsgQ_->pending());
+    setIntegerParam(BFNumWorkers, numWorkers_);
+    resizing_ = false;
+    return status;
+}
+
+/** Pre-faults the NDArray buffers that the acquisition will use, so the first frames do not pay for
+  * page faults in the copy.  BFPreallocArrays NDArrays of the current frame size are allocated from the pool,
+  * optionally advised to use huge pages, touched, optionally locked in memory, and released back to the
+  * pool where processImageThread will reuse them.  The buffers locked by the previous acquisition are
+  * unlocked first, because the pool frees them if the frame size has changed.
+  * This runs on the port thread, which placeThread() has not set up, so each buffer is bound to the
+  * NUMA node of the board before it is touched.
+  */
+void ADBitFlow::prepareMemory()
+{
+    static const char *functionName = "prepareMemory";
+    int numArrays, hugePages, lockMem;
+    size_t dims[2];
+    size_t dataSize;
+    int pixelSize;
+    int hugePageErrors=0, lockErrors=0, nodeErrors=0;
+    std::vector<NDArray *> arrays;
+
+    getIntegerParam(BFPreallocArrays, &numArrays);
+    getIntegerParam(BFHugePages, &hugePages);
+    getIntegerParam(BFLockMemory, &lockMem);
+    unlockMemoryAll();
+    if (numArrays > 0) {
+#ifdef _WIN32
+        dims[0] = pBoard_->getBrdInfo(BiCamInqXSize);
+        dims[1] = pBoard_->getBrdInfo(BiCamInqYSize0);
+        pixelSize = pBoard_->getBrdInfo(BiCamInqBytesPerPix);
+#else
+        int iTemp;
+        getIntegerParam(ADSizeX, &iTemp);
+        dims[0] = iTemp;
+        getIntegerParam(ADSizeY, &iTemp);
+        dims[1] = iTemp;
+        pixelSize = bitsPerPixel_/8;
+#endif
+        dataSize = dims[0] * dims[1] * pixelSize;
+        for (int i=0; i<numArrays; i++) {
+            NDArray *pArray = pNDArrayPool->alloc(2, dims, NDUInt8, dataSize, NULL);
+            if (!pArray) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s only %d of %d arrays could be allocated, maxMemory is too small\n",
+                    driverName, functionName, i, numArrays);
+                break;
+            }
+            arrays.push_back(pArray);
+            if (hugePages && adviseHugePages(pArray->pData, pArray->dataSize)) hugePageErrors++;
+            if (bindMemoryNode(pArray->pData, pArray->dataSize, numaNode_)) nodeErrors++;
+            touchMemory(pArray->pData, pArray->dataSize);
+            if (lockMem) {
+                if (lockMemory(pArray->pData, pArray->dataSize)) lockErrors++;
+                else lockedMemory_.push_back(std::make_pair(pArray->pData, pArray->dataSize));
+            }
+        }
+        for (size_t i=0; i<arrays.size(); i++) {
+            arrays[i]->release();
+        }
+        if (hugePageErrors) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s huge pages could not be enabled for %d arrays\n",
+                driverName, functionName, hugePageErrors);
+        }
+        if (lockErrors) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s %d arrays could not be locked in memory, check RLIMIT_MEMLOCK\n",
+                driverName, functionName, lockErrors);
+        }
+        if (nodeErrors) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s %d arrays could not be placed on NUMA node %d\n",
+                driverName, functionName, nodeErrors, numaNode_);
+        }
+    }
+    setDoubleParam(BFHugePageMemory, getHugePageMemory());
+}
+
+/** Unlocks the NDArray buffers locked by prepareMemory(), while they are still owned by the pool.
+  */
+void ADBitFlow::unlockMemoryAll()
+{
+    for (size_t i=0; i<lockedMemory_.size(); i++) {
+        unlockMemory(lockedMemory_[i].first, lockedMemory_[i].second);
+    }
+    lockedMemory_.clear();
+}
+
 asynStatus ADBitFlow::startCapture()
 {
     static const char *functionName = "startCapture";
     
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s entry\n", driverName, functionName);
+    if (resizing_) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s the buffers are being resized\n", driverName, functionName);
+        return asynError;
+    }
+    if (stopping_) {
+        // The stop in progress sets ADAcquire=0 when it completes
+        waitForStop();
+        setIntegerParam(ADAcquire, 1);
+    }
+    if (checkMemoryBudget()) {
+        setIntegerParam(ADAcquire, 0);
+        return asynError;
+    }
     
+    prepareMemory();
+    // The arrival times from a previous acquisition may include latency that no longer applies
+    pClockModel_->reset();
+    pJitterModel_->reset();
+    pLatencyStats_->reset();
+    epicsAtomicSetIntT(&acquiring_, 1);
     GenICamFeature *acquisitionStart = mGCFeatureSet.getByName("AcquisitionStart");
     acquisitionStart->writeCommand();
+    featureEvent("AcquisitionStart");
 #ifdef _WIN32
     pBoard_->cirControl(BISTART, BiAsync);
 #else
@@ -758,22 +2826,51 @@ asynStatus ADBitFlow::stopCapture()
     static const char *functionName = "stopCapture";
 
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s entry\n", driverName, functionName);
+    // Another thread, e.g. a worker that completed the last frame, is already stopping
+    if (stopping_) {
+        waitForStop();
+        return asynSuccess;
+    }
+    stopping_ = true;
+    recovering_ = false;
+    // Ends the busy-poll of waitImageThread in inline mode
+    epicsAtomicSetIntT(&acquiring_, 0);
 #ifdef _WIN32
     pBoard_->cirControl(BIABORT, BiAsync);
 #else
     CiAqStop(hBoard_);
 #endif
+    // Let the board finish the frame in progress.  The lock is released so that the workers, the
+    // parameter callbacks and, in inline mode, the wait thread that called this are not blocked.
+    // startCapture() and other callers of stopCapture() wait in waitForStop() until this is complete.
+    unlock();
     epicsThreadSleep(1.0);
+    lock();
     GenICamFeature *acquisitionStop = mGCFeatureSet.getByName("AcquisitionStop");
     acquisitionStop->writeCommand();
+    featureEvent("AcquisitionEnd");
 
     // Set ADAcquire=0 which will tell the imageGrabTask to stop
     setIntegerParam(ADAcquire, 0);
+    // Flush the final counter values rather than waiting for statusThread
+    updateStatus();
     setShutter(0);
+    stopping_ = false;
+    epicsEventSignal(stopDoneEventId_);
 
     return asynSuccess;
 }
 
+/** Waits for the stopCapture() in progress in another thread to complete.  Called with the lock held. */
+void ADBitFlow::waitForStop()
+{
+    while (stopping_) {
+        unlock();
+        epicsEventWaitWithTimeout(stopDoneEventId_, 0.1);
+        lock();
+    }
+}
+
 /** Print out a report; calls ADGenICam::report to get base class report as well.
   * \param[in] fp File pointer to write output to
   * \param[in] details Level of detail desired.  If >1 prints information about 
@@ -782,10 +2879,54 @@ asynStatus ADBitFlow::stopCapture()
 
 void ADBitFlow::report(FILE *fp, int details)
 {
+    int configWritten, configFailed;
+    double configRestoreTime;
     //static const char *functionName = "report";
 
     fprintf(fp, "\n");
     fprintf(fp, "Report for camera in use:\n");
+    fprintf(fp, "  Board PCI address:     %s\n", boardPCIAddress_.empty() ? "unknown" : boardPCIAddress_.c_str());
+    fprintf(fp, "  Board NUMA node:       %d\n", numaNode_);
+    fprintf(fp, "  Board local CPUs:      %s\n", numaCPUs_.empty() ? "unknown" : formatCPUList(numaCPUs_).c_str());
+    fprintf(fp, "  Wait thread CPUs:      %s\n", 
+            !waitThreadCPUs_.empty() ? formatCPUList(waitThreadCPUs_).c_str() : 
+            !numaCPUs_.empty() ? formatCPUList(numaCPUs_).c_str() : "any");
+    fprintf(fp, "  Worker thread CPUs:    %s\n", 
+            !workerThreadCPUs_.empty() ? formatCPUList(workerThreadCPUs_).c_str() : 
+            !numaCPUs_.empty() ? formatCPUList(numaCPUs_).c_str() : "any");
+    fprintf(fp, "  Real-time priority:    %d\n", realTimePriority_);
+    fprintf(fp, "  Huge page memory:      %.1f MB\n", getHugePageMemory());
+    fprintf(fp, "  GenICam nodes opened:  %d of %d in %.3f s\n", nodesResolved_, (int)features_.size(), nodeResolveTime_);
+    fprintf(fp, "  Time to iocInit done:  %.3f s\n", iocInitTime_);
+    fprintf(fp, "  Time to first frame:   %.3f s\n", startupTime_);
+    getIntegerParam(BFConfigWritten, &configWritten);
+    getIntegerParam(BFConfigFailed, &configFailed);
+    getDoubleParam(BFConfigRestoreTime, &configRestoreTime);
+    fprintf(fp, "  Last config restore:   %d written, %d failed in %.3f s\n", configWritten, configFailed, configRestoreTime);
+    double p50, p99, max;
+    fprintf(fp, "  Feature events:        %d\n", featureEvents_);
+    if (pDeviceEvents_ && pDeviceEvents_->isRunning()) {
+        fprintf(fp, "  GenTL device events:   %d, feature invalidations: %d\n",
+                pDeviceEvents_->getDeviceEvents(), pDeviceEvents_->getInvalidations());
+    }
+    fprintf(fp, "  Control channel:       %d reads, %d writes, %.3f s\n",
+            pControlStats_->getReads(), pControlStats_->getWrites(), pControlStats_->getTime());
+    pControlStats_->getReadPercentiles(&p50, &p99, &max);
+    fprintf(fp, "    Read latency:        p50=%.3f p99=%.3f max=%.3f ms\n", p50, p99, max);
+    pControlStats_->getWritePercentiles(&p50, &p99, &max);
+    fprintf(fp, "    Write latency:       p50=%.3f p99=%.3f max=%.3f ms\n", p50, p99, max);
+    if (details > 0) {
+        std::vector<BFFeature *> top;
+        topFeatures(20, top);
+        fprintf(fp, "    %-32s %8s %8s %10s %10s\n", "Feature", "Reads", "Writes", "Total ms", "Max ms");
+        pControlStats_->lock();
+        for (size_t i=0; i<top.size(); i++) {
+            BFNodeStats & stats = top[i]->getNodeStats();
+            fprintf(fp, "    %-32s %8d %8d %10.3f %10.3f\n", top[i]->getFeatureName().c_str(),
+                    stats.reads, stats.writes, (stats.readTime + stats.writeTime)*1000., stats.maxTime*1000.);
+        }
+        pControlStats_->unlock();
+    }
     ADGenICam::report(fp, details);
     return;
 }
@@ -797,24 +2938,194 @@ static const iocshArg configArg3 = {"# processing threads", iocshArgInt};
 static const iocshArg configArg4 = {"maxMemory", iocshArgInt};
 static const iocshArg configArg5 = {"priority", iocshArgInt};
 static const iocshArg configArg6 = {"stackSize", iocshArgInt};
+static const iocshArg configArg7 = {"waitThreadCPUs", iocshArgString};
+static const iocshArg configArg8 = {"workerThreadCPUs", iocshArgString};
+static const iocshArg configArg9 = {"realTimePriority", iocshArgInt};
 static const iocshArg * const configArgs[] = {&configArg0,
                                               &configArg1,
                                               &configArg2,
                                               &configArg3,
                                               &configArg4,
                                               &configArg5,
-                                              &configArg6};
-static const iocshFuncDef configADBitFlow = {"ADBitFlowConfig", 7, configArgs};
+                                              &configArg6,
+                                              &configArg7,
+                                              &configArg8,
+                                              &configArg9};
+static const iocshFuncDef configADBitFlow = {"ADBitFlowConfig", 10, configArgs};
 static void configCallFunc(const iocshArgBuf *args)
 {
     ADBitFlowConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival, 
-                    args[4].ival, args[5].ival, args[6].ival);
+                    args[4].ival, args[5].ival, args[6].ival,
+                    args[7].sval, args[8].sval, args[9].ival);
+}
+
+
+/** Returns the driver of an ADBitFlow port for an iocsh command, or NULL after printing why not.
+  * Other drivers are registered too, for example the <port>_PREVIEW port, so the type is checked.
+  */
+static ADBitFlow *findBitFlowDriver(const char *command, const char *portName)
+{
+    asynPortDriver *pPort;
+    ADBitFlow *pDrv;
+
+    if (!portName) {
+        printf("%s: no port name\n", command);
+        return NULL;
+    }
+    pPort = (asynPortDriver *)findAsynPortDriver(portName);
+    if (!pPort) {
+        printf("%s: cannot find port %s\n", command, portName);
+        return NULL;
+    }
+    pDrv = dynamic_cast<ADBitFlow *>(pPort);
+    if (!pDrv) {
+        printf("%s: port %s is not an ADBitFlow port\n", command, portName);
+    }
+    return pDrv;
+}
+
+static const iocshArg traceDumpArg0 = {"Port name", iocshArgString};
+static const iocshArg traceDumpArg1 = {"count", iocshArgInt};
+static const iocshArg * const traceDumpArgs[] = {&traceDumpArg0,
+                                                 &traceDumpArg1};
+static const iocshFuncDef traceDumpADBitFlow = {"ADBitFlowTraceDump", 2, traceDumpArgs};
+static void traceDumpCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowTraceDump", args[0].sval);
+    if (!pDrv) return;
+    pDrv->traceDump(stdout, args[1].ival);
+}
+
+static const iocshArg traceChromeArg0 = {"Port name", iocshArgString};
+static const iocshArg traceChromeArg1 = {"fileName", iocshArgString};
+static const iocshArg traceChromeArg2 = {"seconds", iocshArgDouble};
+static const iocshArg * const traceChromeArgs[] = {&traceChromeArg0,
+                                                   &traceChromeArg1,
+                                                   &traceChromeArg2};
+static const iocshFuncDef traceChromeADBitFlow = {"ADBitFlowTraceChrome", 3, traceChromeArgs};
+static void traceChromeCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowTraceChrome", args[0].sval);
+    if (!pDrv) return;
+    if (!args[1].sval) {
+        printf("ADBitFlowTraceChrome: no file name\n");
+        return;
+    }
+    pDrv->traceChrome(args[1].sval, args[2].dval);
+}
+
+static const iocshArg pollClassArg0 = {"Port name", iocshArgString};
+static const iocshArg pollClassArg1 = {"featureName", iocshArgString};
+static const iocshArg pollClassArg2 = {"pollClass", iocshArgString};
+static const iocshArg * const pollClassArgs[] = {&pollClassArg0,
+                                                 &pollClassArg1,
+                                                 &pollClassArg2};
+static const iocshFuncDef pollClassADBitFlow = {"ADBitFlowPollClass", 3, pollClassArgs};
+static void pollClassCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowPollClass", args[0].sval);
+    if (!pDrv) return;
+    if (!args[1].sval || !args[2].sval) {
+        printf("ADBitFlowPollClass: featureName and pollClass are required\n");
+        return;
+    }
+    pDrv->setPollClass(args[1].sval, args[2].sval);
+}
+
+static const iocshArg featureMapArg0 = {"Port name", iocshArgString};
+static const iocshArg featureMapArg1 = {"directory", iocshArgString};
+static const iocshArg * const featureMapArgs[] = {&featureMapArg0,
+                                                  &featureMapArg1};
+static const iocshFuncDef featureMapADBitFlow = {"ADBitFlowFeatureMap", 2, featureMapArgs};
+static void featureMapCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowFeatureMap", args[0].sval);
+    if (!pDrv) return;
+    if (!args[1].sval) {
+        printf("ADBitFlowFeatureMap: no directory\n");
+        return;
+    }
+    pDrv->loadFeatureMap(args[1].sval);
+}
+
+static const iocshArg configFileArg0 = {"Port name", iocshArgString};
+static const iocshArg configFileArg1 = {"fileName", iocshArgString};
+static const iocshArg * const configFileArgs[] = {&configFileArg0,
+                                                  &configFileArg1};
+static const iocshFuncDef saveConfigADBitFlow = {"ADBitFlowSaveConfig", 2, configFileArgs};
+static void saveConfigCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowSaveConfig", args[0].sval);
+    if (!pDrv) return;
+    if (!args[1].sval) {
+        printf("ADBitFlowSaveConfig: no file name\n");
+        return;
+    }
+    pDrv->lock();
+    if (pDrv->saveConfig(args[1].sval)) printf("ADBitFlowSaveConfig: error writing %s\n", args[1].sval);
+    pDrv->unlock();
 }
 
+static const iocshFuncDef restoreConfigADBitFlow = {"ADBitFlowRestoreConfig", 2, configFileArgs};
+static void restoreConfigCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowRestoreConfig", args[0].sval);
+    if (!pDrv) return;
+    if (!args[1].sval) {
+        printf("ADBitFlowRestoreConfig: no file name\n");
+        return;
+    }
+    pDrv->lock();
+    if (pDrv->restoreConfig(args[1].sval)) printf("ADBitFlowRestoreConfig: error restoring %s\n", args[1].sval);
+    pDrv->unlock();
+}
+
+static const iocshArg featureEventArg0 = {"Port name", iocshArgString};
+static const iocshArg featureEventArg1 = {"eventName", iocshArgString};
+static const iocshArg featureEventArg2 = {"featureName", iocshArgString};
+static const iocshArg * const featureEventArgs[] = {&featureEventArg0,
+                                                    &featureEventArg1,
+                                                    &featureEventArg2};
+static const iocshFuncDef featureEventADBitFlow = {"ADBitFlowFeatureEvent", 3, featureEventArgs};
+static void featureEventCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowFeatureEvent", args[0].sval);
+    if (!pDrv) return;
+    if (!args[1].sval || !args[2].sval) {
+        printf("ADBitFlowFeatureEvent: eventName and featureName are required\n");
+        return;
+    }
+    pDrv->subscribeEvent(args[1].sval, args[2].sval);
+}
+
+static const iocshArg deviceEventsArg0 = {"Port name", iocshArgString};
+static const iocshArg deviceEventsArg1 = {"ctiFile", iocshArgString};
+static const iocshArg deviceEventsArg2 = {"interfaceIndex", iocshArgInt};
+static const iocshArg deviceEventsArg3 = {"deviceIndex", iocshArgInt};
+static const iocshArg * const deviceEventsArgs[] = {&deviceEventsArg0,
+                                                    &deviceEventsArg1,
+                                                    &deviceEventsArg2,
+                                                    &deviceEventsArg3};
+static const iocshFuncDef deviceEventsADBitFlow = {"ADBitFlowDeviceEvents", 4, deviceEventsArgs};
+static void deviceEventsCallFunc(const iocshArgBuf *args)
+{
+    ADBitFlow *pDrv = findBitFlowDriver("ADBitFlowDeviceEvents", args[0].sval);
+    if (!pDrv) return;
+    pDrv->startDeviceEvents(args[1].sval, args[2].ival, args[3].ival);
+}
 
 static void ADBitFlowRegister(void)
 {
     iocshRegister(&configADBitFlow, configCallFunc);
+    iocshRegister(&traceDumpADBitFlow, traceDumpCallFunc);
+    iocshRegister(&traceChromeADBitFlow, traceChromeCallFunc);
+    iocshRegister(&pollClassADBitFlow, pollClassCallFunc);
+    iocshRegister(&featureMapADBitFlow, featureMapCallFunc);
+    iocshRegister(&saveConfigADBitFlow, saveConfigCallFunc);
+    iocshRegister(&restoreConfigADBitFlow, restoreConfigCallFunc);
+    iocshRegister(&featureEventADBitFlow, featureEventCallFunc);
+    iocshRegister(&deviceEventsADBitFlow, deviceEventsCallFunc);
+    initHookRegister(bitFlowInitHook);
 }
 
 extern "C" {
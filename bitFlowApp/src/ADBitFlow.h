@@ -1,9 +1,16 @@
 #ifndef ADBITFLOW_H
 #define ADBITFLOW_H
 
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <epicsEvent.h>
 
 #include <ADGenICam.h>
+#include "BFFeature.h"
 #ifdef _WIN32
   #include "CircularInterface.h"
   using namespace BufferAcquisition;
@@ -11,14 +18,106 @@
   #include "BFciLib.h"
 #endif
 
+class BFTracer;
+class BFClockModel;
+class BFLatencyStats;
+class BFPreview;
+class BFFeatureMap;
+class BFDeviceEvents;
+struct workerQueueElement;
+
 #define BFTimeStampModeString               "BF_TIME_STAMP_MODE"                // asynParamInt32, R/O
 #define BFUniqueIdModeString                "BF_UNIQUE_ID_MODE"                 // asynParamInt32, R/O
-#define BFBufferSizeString                  "BF_BUFFER_SIZE"                    // asynParamInt32, R/O
+#define BFBufferSizeString                  "BF_BUFFER_SIZE"                    // asynParamInt32, R/W
 #define BFBufferQueueSizeString             "BF_BUFFER_QUEUE_SIZE"              // asynParamInt32, R/O
 #define BFMessageQueueSizeString            "BF_MESSAGE_QUEUE_SIZE"             // asynParamInt32, R/O
 #define BFMessageQueueFreeString            "BF_MESSAGE_QUEUE_FREE"             // asynParamInt32, R/O
 #define BFProcessTotalTimeString            "BF_PROCESS_TOTAL_TIME"             // asynParamFloat64, R/O
 #define BFProcessCopyTimeString             "BF_PROCESS_COPY_TIME"              // asynParamFloat64, R/O
+#define BFStatusUpdateRateString            "BF_STATUS_UPDATE_RATE"             // asynParamFloat64, R/W
+#define BFNUMANodeString                    "BF_NUMA_NODE"                      // asynParamInt32, R/O
+#define BFPreallocArraysString              "BF_PREALLOC_ARRAYS"                // asynParamInt32, R/W
+#define BFHugePagesString                   "BF_HUGE_PAGES"                     // asynParamInt32, R/W
+#define BFLockMemoryString                  "BF_LOCK_MEMORY"                    // asynParamInt32, R/W
+#define BFHugePageMemoryString              "BF_HUGE_PAGE_MEMORY"               // asynParamFloat64, R/O
+#define BFClockSyncString                   "BF_CLOCK_SYNC"                     // asynParamInt32, R/W
+#define BFClockWindowString                 "BF_CLOCK_WINDOW"                   // asynParamInt32, R/W
+#define BFClockSamplesString                "BF_CLOCK_SAMPLES"                  // asynParamInt32, R/O
+#define BFClockFrequencyString              "BF_CLOCK_FREQUENCY"                // asynParamFloat64, R/O
+#define BFClockResidualString               "BF_CLOCK_RESIDUAL"                 // asynParamFloat64, R/O
+#define BFProcessingModeString              "BF_PROCESSING_MODE"                // asynParamInt32, R/W
+#define BFLatencyP50String                  "BF_LATENCY_P50"                    // asynParamFloat64, R/O
+#define BFLatencyP99String                  "BF_LATENCY_P99"                    // asynParamFloat64, R/O
+#define BFLatencyMaxString                  "BF_LATENCY_MAX"                    // asynParamFloat64, R/O
+#define BFWaitStrategyString                "BF_WAIT_STRATEGY"                  // asynParamInt32, R/W
+#define BFWaitSpinTimeString                "BF_WAIT_SPIN_TIME"                 // asynParamFloat64, R/W
+#define BFArrivalJitterBlockingP50String    "BF_ARRIVAL_JITTER_BLOCKING_P50"    // asynParamFloat64, R/O
+#define BFArrivalJitterBlockingP99String    "BF_ARRIVAL_JITTER_BLOCKING_P99"    // asynParamFloat64, R/O
+#define BFArrivalJitterBusyPollP50String    "BF_ARRIVAL_JITTER_BUSY_POLL_P50"   // asynParamFloat64, R/O
+#define BFArrivalJitterBusyPollP99String    "BF_ARRIVAL_JITTER_BUSY_POLL_P99"   // asynParamFloat64, R/O
+#define BFArrivalJitterHybridP50String      "BF_ARRIVAL_JITTER_HYBRID_P50"      // asynParamFloat64, R/O
+#define BFArrivalJitterHybridP99String      "BF_ARRIVAL_JITTER_HYBRID_P99"      // asynParamFloat64, R/O
+#define BFStallTimeoutString                "BF_STALL_TIMEOUT"                  // asynParamFloat64, R/W
+#define BFStallFactorString                 "BF_STALL_FACTOR"                   // asynParamFloat64, R/W
+#define BFStallRecoveryString               "BF_STALL_RECOVERY"                 // asynParamInt32, R/W
+#define BFStalledString                     "BF_STALLED"                        // asynParamInt32, R/O
+#define BFRecoveriesString                  "BF_RECOVERIES"                     // asynParamInt32, R/W
+#define BFFrameIntervalString               "BF_FRAME_INTERVAL"                 // asynParamFloat64, R/O
+#define BFMinWorkersString                  "BF_MIN_WORKERS"                    // asynParamInt32, R/W
+#define BFMaxWorkersString                  "BF_MAX_WORKERS"                    // asynParamInt32, R/W
+#define BFNumWorkersString                  "BF_NUM_WORKERS"                    // asynParamInt32, R/O
+#define BFWorkerUtilizationString           "BF_WORKER_UTILIZATION"             // asynParamFloat64, R/O
+#define BFBufferBytesString                 "BF_BUFFER_BYTES"                   // asynParamFloat64, R/O
+#define BFMemoryBudgetString                "BF_MEMORY_BUDGET"                  // asynParamFloat64, R/W
+#define BFMemoryPolicyString                "BF_MEMORY_POLICY"                  // asynParamInt32, R/W
+#define BFMemoryRingString                  "BF_MEMORY_RING"                    // asynParamFloat64, R/O
+#define BFMemorySlabString                  "BF_MEMORY_SLAB"                    // asynParamFloat64, R/O
+#define BFMemoryQueueString                 "BF_MEMORY_QUEUE"                   // asynParamFloat64, R/O
+#define BFMemoryPreviewString               "BF_MEMORY_PREVIEW"                 // asynParamFloat64, R/O
+#define BFMemoryTotalString                 "BF_MEMORY_TOTAL"                   // asynParamFloat64, R/O
+#define BFMemoryPoolString                  "BF_MEMORY_POOL"                    // asynParamFloat64, R/O
+#define BFPreviewEnableString               "BF_PREVIEW_ENABLE"                 // asynParamInt32, R/W
+#define BFPreviewRateString                 "BF_PREVIEW_RATE"                   // asynParamFloat64, R/W
+#define BFPreviewBinningString              "BF_PREVIEW_BINNING"                // asynParamInt32, R/W
+#define BFPreview8BitString                 "BF_PREVIEW_8BIT"                   // asynParamInt32, R/W
+#define BFPreviewShiftString                "BF_PREVIEW_SHIFT"                  // asynParamInt32, R/W
+#define BFPreviewCounterString              "BF_PREVIEW_COUNTER"                // asynParamInt32, R/O
+#define BFFeatureCacheAgeString             "BF_FEATURE_CACHE_AGE"              // asynParamFloat64, R/W
+#define BFFeatureCacheHitsString            "BF_FEATURE_CACHE_HITS"             // asynParamInt32, R/O
+#define BFFeatureCacheMissesString          "BF_FEATURE_CACHE_MISSES"           // asynParamInt32, R/O
+#define BFIocInitTimeString                 "BF_IOC_INIT_TIME"                  // asynParamFloat64, R/O
+#define BFStartupTimeString                 "BF_STARTUP_TIME"                   // asynParamFloat64, R/O
+#define BFNodesResolvedString               "BF_NODES_RESOLVED"                 // asynParamInt32, R/O
+#define BFNodeResolveTimeString             "BF_NODE_RESOLVE_TIME"              // asynParamFloat64, R/O
+#define BFPollEnableString                  "BF_POLL_ENABLE"                    // asynParamInt32, R/W
+#define BFPollFastPeriodString              "BF_POLL_FAST_PERIOD"               // asynParamFloat64, R/W
+#define BFPollSlowPeriodString              "BF_POLL_SLOW_PERIOD"               // asynParamFloat64, R/W
+#define BFPollCountString                   "BF_POLL_COUNT"                     // asynParamInt32, R/O
+#define BFPollTimeString                    "BF_POLL_TIME"                      // asynParamFloat64, R/O
+#define BFAsyncWritesString                 "BF_ASYNC_WRITES"                   // asynParamInt32, R/W
+#define BFWritesPendingString               "BF_WRITES_PENDING"                 // asynParamInt32, R/O
+#define BFWritesCoalescedString             "BF_WRITES_COALESCED"               // asynParamInt32, R/O
+#define BFWriteLatencyP50String             "BF_WRITE_LATENCY_P50"              // asynParamFloat64, R/O
+#define BFWriteLatencyP99String             "BF_WRITE_LATENCY_P99"              // asynParamFloat64, R/O
+#define BFWriteLatencyMaxString             "BF_WRITE_LATENCY_MAX"              // asynParamFloat64, R/O
+#define BFFeatureMapNodesString             "BF_FEATURE_MAP_NODES"              // asynParamInt32, R/O
+#define BFFeatureMapMismatchesString        "BF_FEATURE_MAP_MISMATCHES"         // asynParamInt32, R/O
+#define BFConfigFileString                  "BF_CONFIG_FILE"                    // asynParamOctet, R/W
+#define BFConfigSaveString                  "BF_CONFIG_SAVE"                    // asynParamInt32, R/W
+#define BFConfigRestoreString               "BF_CONFIG_RESTORE"                 // asynParamInt32, R/W
+#define BFConfigFeaturesString              "BF_CONFIG_FEATURES"                // asynParamInt32, R/O
+#define BFConfigWrittenString               "BF_CONFIG_WRITTEN"                 // asynParamInt32, R/O
+#define BFConfigFailedString                "BF_CONFIG_FAILED"                  // asynParamInt32, R/O
+#define BFConfigRestoreTimeString           "BF_CONFIG_RESTORE_TIME"            // asynParamFloat64, R/O
+#define BFControlReadsString                "BF_CONTROL_READS"                  // asynParamInt32, R/O
+#define BFControlWritesString               "BF_CONTROL_WRITES"                 // asynParamInt32, R/O
+#define BFControlRateString                 "BF_CONTROL_RATE"                   // asynParamFloat64, R/O
+#define BFControlTimeString                 "BF_CONTROL_TIME"                   // asynParamFloat64, R/O
+#define BFControlReadP99String              "BF_CONTROL_READ_P99"               // asynParamFloat64, R/O
+#define BFControlWriteP99String             "BF_CONTROL_WRITE_P99"              // asynParamFloat64, R/O
+#define BFControlTopString                  "BF_CONTROL_TOP"                    // asynParamOctet, R/O
+#define BFControlResetString                "BF_CONTROL_RESET"                  // asynParamInt32, R/W
+#define BFFeatureEventsString               "BF_FEATURE_EVENTS"                 // asynParamInt32, R/O
 
 /** Main driver class inherited from areaDetectors ADDriver class.
  * One instance of this class will control one camera.
@@ -27,20 +126,43 @@ class ADBitFlow : public ADGenICam
 {
 public:
     ADBitFlow(const char *portName, int cameraId, int numSPBuffers, int numThreads,
-              size_t maxMemory, int priority, int stackSize);
+              size_t maxMemory, int priority, int stackSize,
+              const char *waitThreadCPUs, const char *workerThreadCPUs, int realTimePriority);
 
     // virtual methods to override from ADGenICam
     virtual asynStatus writeInt32( asynUser *pasynUser, epicsInt32 value);
-    //virtual asynStatus writeFloat64( asynUser *pasynUser, epicsFloat64 value);
+    virtual asynStatus writeFloat64( asynUser *pasynUser, epicsFloat64 value);
     void report(FILE *fp, int details);
     virtual GenICamFeature *createFeature(GenICamFeatureSet *set, 
                                           std::string const & asynName, asynParamType asynType, int asynIndex,
                                           std::string const & featureName, GCFeatureType_t featureType);
     
     BFGTLDev getBFGTLDev();
+    BFFeatureCache *getFeatureCache();
+    BFFeatureMap *getFeatureMap();
+    BFControlStats *getControlStats();
+    asynStatus loadFeatureMap(const char *directory);
+    asynStatus saveConfig(const char *fileName);
+    asynStatus restoreConfig(const char *fileName);
+    void featureResolved(double seconds);
+    void iocRunning();
+    asynStatus setPollClass(const char *featureName, const char *pollClass);
+    asynStatus subscribeEvent(const char *eventName, const char *featureName);
+    asynStatus startDeviceEvents(const char *ctiFile, int interfaceIndex, int deviceIndex);
+    void deviceEvent(const char *eventName);
+    void featureInvalidated(const char *featureName);
+    bool queueWrite(BFFeature *pFeature, BFWriteType_t type, BFFeatureValue const & value);
+    void writeDone(double seconds);
+    void traceDump(FILE *fp, int count);
+    void traceChrome(const char *fileName, double seconds);
     /**< These should be private but are called from C callback functions, must be public. */
     void waitImageThread();
     void processImageThread();
+    void statusThread();
+    void resolveFeaturesThread();
+    void pollThread();
+    void controlThread();
+    void previewThread();
     void shutdown();
 
 private:
@@ -53,6 +175,90 @@ private:
     int BFMessageQueueFree;
     int BFProcessTotalTime;
     int BFProcessCopyTime;
+    int BFStatusUpdateRate;
+    int BFNUMANode;
+    int BFPreallocArrays;
+    int BFHugePages;
+    int BFLockMemory;
+    int BFHugePageMemory;
+    int BFClockSync;
+    int BFClockWindow;
+    int BFClockSamples;
+    int BFClockFrequency;
+    int BFClockResidual;
+    int BFProcessingMode;
+    int BFLatencyP50;
+    int BFLatencyP99;
+    int BFLatencyMax;
+    int BFWaitStrategy;
+    int BFWaitSpinTime;
+    int BFArrivalJitterBlockingP50;
+    int BFArrivalJitterBlockingP99;
+    int BFArrivalJitterBusyPollP50;
+    int BFArrivalJitterBusyPollP99;
+    int BFArrivalJitterHybridP50;
+    int BFArrivalJitterHybridP99;
+    int BFStallTimeout;
+    int BFStallFactor;
+    int BFStallRecovery;
+    int BFStalled;
+    int BFRecoveries;
+    int BFFrameInterval;
+    int BFMinWorkers;
+    int BFMaxWorkers;
+    int BFNumWorkers;
+    int BFWorkerUtilization;
+    int BFBufferBytes;
+    int BFMemoryBudget;
+    int BFMemoryPolicy;
+    int BFMemoryRing;
+    int BFMemorySlab;
+    int BFMemoryQueue;
+    int BFMemoryPreview;
+    int BFMemoryTotal;
+    int BFMemoryPool;
+    int BFPreviewEnable;
+    int BFPreviewRate;
+    int BFPreviewBinning;
+    int BFPreview8Bit;
+    int BFPreviewShift;
+    int BFPreviewCounter;
+    int BFFeatureCacheAge;
+    int BFFeatureCacheHits;
+    int BFFeatureCacheMisses;
+    int BFIocInitTime;
+    int BFStartupTime;
+    int BFNodesResolved;
+    int BFNodeResolveTime;
+    int BFPollEnable;
+    int BFPollFastPeriod;
+    int BFPollSlowPeriod;
+    int BFPollCount;
+    int BFPollTime;
+    int BFAsyncWrites;
+    int BFWritesPending;
+    int BFWritesCoalesced;
+    int BFWriteLatencyP50;
+    int BFWriteLatencyP99;
+    int BFWriteLatencyMax;
+    int BFFeatureMapNodes;
+    int BFFeatureMapMismatches;
+    int BFConfigFile;
+    int BFConfigSave;
+    int BFConfigRestore;
+    int BFConfigFeatures;
+    int BFConfigWritten;
+    int BFConfigFailed;
+    int BFConfigRestoreTime;
+    int BFControlReads;
+    int BFControlWrites;
+    int BFControlRate;
+    int BFControlTime;
+    int BFControlReadP99;
+    int BFControlWriteP99;
+    int BFControlTop;
+    int BFControlReset;
+    int BFFeatureEvents;
 
     /* Local methods to this class */
     asynStatus grabImage();
@@ -61,7 +267,32 @@ private:
     asynStatus connectCamera();
     asynStatus disconnectCamera();
     asynStatus setROI();
+    asynStatus setBufferSize(int numBuffers);
+    asynStatus resizeMessageQueue(int size);
+    double getFrameBytes();
+    double getBufferBytes();
+    double computeMemory(int numBuffers, int numArrays, double *ring, double *slab, double *queue, double *preview);
+    asynStatus checkMemoryBudget();
+    asynStatus fitBufferSize();
+    bool previewDue();
+    void processFrame(struct workerQueueElement *pWqe);
+    void updateStatus();
+    void updateStatistics();
+    void frameArrived(epicsTimeStamp const & arrivalTime);
+    void checkStall();
+    asynStatus recoverAcquisition();
+    void prepareMemory();
+    void unlockMemoryAll();
     void reportNode(FILE *fp, const char *nodeName, int level);
+    void placeThread(std::vector<int> const & cpus, int priority);
+    void startWorker();
+    void adjustWorkers();
+    void flushWrites();
+    void waitForStop();
+    std::string readNodeString(const char *nodeName);
+    void saveFeatureMap();
+    void topFeatures(size_t count, std::vector<BFFeature *> & top);
+    void featureEvent(const char *eventName);
 
     /* Data */
     int boardNum_;
@@ -73,13 +304,90 @@ private:
       int *pBoard_;  // Unused
     #endif
     BFGTLDev hDevice_;
+    BFFeatureCache *pFeatureCache_;
+    /* Node metadata saved to disk, see ADBitFlowFeatureMap */
+    BFFeatureMap *pFeatureMap_;
+    /* Transactions made by the features on the control channel */
+    BFControlStats *pControlStats_;
+    int controlTransactions_;
+    epicsTimeStamp controlRateTime_;
+    epicsTimeStamp statisticsTime_;
+    /* Features are opened lazily, resolveFeaturesThread opens the remaining ones after iocInit */
+    std::vector<BFFeature *> features_;
+    int nodesResolved_;
+    double nodeResolveTime_;
+    int featureMapMismatches_;
+    /* Polling classes set with ADBitFlowPollClass, applied to features created later */
+    std::map<std::string, int> pollClasses_;
+    /* Features read by pollThread when a driver event occurs, set with ADBitFlowFeatureEvent */
+    std::multimap<std::string, std::string> eventFeatures_;
+    int featureEvents_;
+    /* GenTL device events and feature invalidations, started with ADBitFlowDeviceEvents */
+    BFDeviceEvents *pDeviceEvents_;
+    /* Startup timing, in seconds since the driver was created */
+    epicsTimeStamp createTime_;
+    double iocInitTime_;
+    double startupTime_;
     int numBFBuffers_;
+    size_t maxMemory_;
     int bitsPerPixel_;
+    double bufferBytes_;  // Bytes of one DMA buffer, with the rows padded to the stride
     int exiting_;
     epicsEventId startEventId_;
+    epicsEventId statusEventId_;
+    epicsEventId pollEventId_;
+    /* Feature writes executed by controlThread when BFAsyncWrites is enabled */
+    std::deque<BFPendingWrite> writeQueue_;
+    bool writeBusy_;
+    int writesCoalesced_;
+    BFLatencyStats *pWriteLatency_;
+    epicsEventId writeEventId_;
+    epicsEventId writeDoneEventId_;
     epicsMessageQueue *pMsgQ_;
     int messageQueueSize_;
     int uniqueId_;
+    /* Per-frame statistics.  The counters are updated with epicsAtomic by the worker threads,
+     * the times are written with the lock held.  statusThread publishes them to the parameter library. */
+    int arrayCounter_;
+    int numImagesCounter_;
+    int bufferQueueSize_;
+    double processTotalTime_;
+    double processCopyTime_;
+    BFTracer *pTracer_;
+    std::vector<int> waitThreadCPUs_;
+    std::vector<int> workerThreadCPUs_;
+    int realTimePriority_;
+    std::vector<int> workerCPUUse_;  // Number of workers pinned to each CPU of workerThreadCPUs_
+    /* Adaptive worker pool, numWorkers_ is the number of workers that have not been asked to exit */
+    int numWorkers_;
+    double workerBusyTime_;
+    epicsTimeStamp lastAdjustTime_;
+    int idleIntervals_;
+    int workersRunning_;
+    bool resizing_;
+    BFPreview *pPreview_;
+    epicsTimeStamp lastPreviewTime_;
+    NDArray *pPreviewArray_;     // Frame waiting for previewThread, reserved or copied by processFrame()
+    epicsEventId previewEventId_;
+    int numaNode_;
+    std::vector<int> numaCPUs_;
+    std::vector<std::pair<void *, size_t> > lockedMemory_;  // NDArray buffers locked by prepareMemory()
+    std::string boardPCIAddress_;
+    std::string sdkVersion_;
+    BFClockModel *pClockModel_;
+    BFLatencyStats *pLatencyStats_;
+    int acquiring_;
+    bool stopping_;      // stopCapture() is waiting for the board without the lock
+    epicsEventId stopDoneEventId_;
+    int waitStrategy_;
+    BFClockModel *pJitterModel_;         // Fitted in waitImageThread on every frame, whatever BFClockSync is
+    BFLatencyStats *pArrivalJitter_[3];  // One per wait strategy
+    /* Stall watchdog, used by waitImageThread */
+    epicsTimeStamp lastFrameTime_;
+    double frameInterval_;
+    bool stalled_;
+    bool recovering_;    // The next aborted status comes from the abort in recoverAcquisition()
+    int framesInFlight_;
 };
 
 #endif
@@ -0,0 +1,132 @@
+// BFClockModel.cpp
+// Model of the relation between the camera (hardware) clock and the host clock.
+
+#include <math.h>
+
+#include "BFClockModel.h"
+
+// Minimum number of samples before the model is used
+static const int minSamples = 8;
+// A sample further than this from the prediction means the hardware clock was reset, so the model is restarted
+static const double resetThreshold = 0.1;
+
+/** Constructor for the BFClockModel class
+  * \param[in] windowSize Number of most recent samples used in the fit.
+  */
+BFClockModel::BFClockModel(int windowSize)
+{
+    setWindowSize(windowSize);
+}
+
+/** Sets the number of samples used in the fit and restarts the model */
+void BFClockModel::setWindowSize(int windowSize)
+{
+    if (windowSize < minSamples) windowSize = minSamples;
+    mWindowSize = windowSize;
+    reset();
+}
+
+/** Discards all samples */
+void BFClockModel::reset()
+{
+    mHwTimes.clear();
+    mHostTimes.clear();
+    mNext = 0;
+    mSinceFit = 0;
+    mValid = false;
+    mSlope = 0.;
+    mIntercept = 0.;
+    mResidual = 0.;
+}
+
+/** Adds a sample to the model.
+  * \param[in] hwTime The hardware timestamp of the frame, in any units.
+  * \param[in] hostTime The host time at which the frame was received.
+  */
+void BFClockModel::addSample(double hwTime, epicsTimeStamp const & hostTime)
+{
+    if (mHwTimes.empty()) {
+        mHwRef = hwTime;
+        mHostRef = hostTime;
+    }
+    double x = hwTime - mHwRef;
+    double y = epicsTimeDiffInSeconds(&hostTime, &mHostRef);
+    if (mValid && (fabs(y - (mIntercept + mSlope*x)) > resetThreshold)) {
+        reset();
+        mHwRef = hwTime;
+        mHostRef = hostTime;
+        x = 0.;
+        y = 0.;
+    }
+    if ((int)mHwTimes.size() < mWindowSize) {
+        mHwTimes.push_back(x);
+        mHostTimes.push_back(y);
+    } else {
+        mHwTimes[mNext] = x;
+        mHostTimes[mNext] = y;
+        mNext = (mNext + 1) % mWindowSize;
+    }
+    // Refitting costs O(windowSize), so only refit every 1/8 of a window once the model is valid
+    mSinceFit++;
+    if (!mValid || (mSinceFit*8 >= mWindowSize)) fit();
+}
+
+void BFClockModel::fit()
+{
+    size_t n = mHwTimes.size();
+    double meanX=0., meanY=0., sxx=0., sxy=0., sumSq=0.;
+
+    mSinceFit = 0;
+    if ((int)n < minSamples) return;
+    for (size_t i=0; i<n; i++) {
+        meanX += mHwTimes[i];
+        meanY += mHostTimes[i];
+    }
+    meanX /= n;
+    meanY /= n;
+    for (size_t i=0; i<n; i++) {
+        double dx = mHwTimes[i] - meanX;
+        sxx += dx*dx;
+        sxy += dx*(mHostTimes[i] - meanY);
+    }
+    // All samples have the same hardware time, nothing to fit
+    if (sxx <= 0.) return;
+    mSlope = sxy/sxx;
+    mIntercept = meanY - mSlope*meanX;
+    for (size_t i=0; i<n; i++) {
+        double r = mHostTimes[i] - (mIntercept + mSlope*mHwTimes[i]);
+        sumSq += r*r;
+    }
+    mResidual = sqrt(sumSq/n);
+    mValid = true;
+}
+
+/** Predicts the host time corresponding to a hardware timestamp.
+  * \param[in] hwTime The hardware timestamp.
+  * \param[out] hostTime The predicted host time.
+  * \return true if the model is valid, false if there are not yet enough samples.
+  */
+bool BFClockModel::predict(double hwTime, epicsTimeStamp *hostTime)
+{
+    if (!mValid) return false;
+    *hostTime = mHostRef;
+    epicsTimeAddSeconds(hostTime, mIntercept + mSlope*(hwTime - mHwRef));
+    return true;
+}
+
+int BFClockModel::getNumSamples()
+{
+    return (int)mHwTimes.size();
+}
+
+/** Returns the fitted hardware clock frequency in ticks per host second, 0 if the model is not valid */
+double BFClockModel::getFrequency()
+{
+    return (mValid && (mSlope != 0.)) ? 1./mSlope : 0.;
+}
+
+/** Returns the RMS residual of the fit in seconds */
+double BFClockModel::getResidual()
+{
+    return mResidual;
+}
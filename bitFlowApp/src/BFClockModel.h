@@ -0,0 +1,43 @@
+// BFClockModel.h
+// Model of the relation between the camera (hardware) clock and the host clock.
+
+#ifndef BF_CLOCK_MODEL_H
+#define BF_CLOCK_MODEL_H
+
+#include <vector>
+
+#include <epicsTime.h>
+
+/** Fits host arrival times against hardware timestamps with a linear regression over a sliding window.
+  * The slope is the host time per hardware tick, so its inverse is the measured hardware clock frequency,
+  * including drift relative to the host clock.  The arrival times contain queue and scheduling jitter,
+  * the fit averages it out so the predicted host times follow the hardware clock.
+  * This class is not thread safe, the caller must serialize access.
+  */
+class BFClockModel {
+public:
+    BFClockModel(int windowSize);
+    void setWindowSize(int windowSize);
+    void reset();
+    void addSample(double hwTime, epicsTimeStamp const & hostTime);
+    bool predict(double hwTime, epicsTimeStamp *hostTime);
+    int getNumSamples();
+    double getFrequency();
+    double getResidual();
+
+private:
+    void fit();
+    int mWindowSize;
+    std::vector<double> mHwTimes;     // Hardware times relative to mHwRef
+    std::vector<double> mHostTimes;   // Host times in seconds relative to mHostRef
+    size_t mNext;
+    int mSinceFit;
+    bool mValid;
+    double mHwRef;
+    epicsTimeStamp mHostRef;
+    double mSlope;
+    double mIntercept;
+    double mResidual;
+};
+
+#endif
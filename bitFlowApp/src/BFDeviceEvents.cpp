@@ -0,0 +1,355 @@
+// BFDeviceEvents.cpp
+// GenTL device events and feature invalidations delivered to the driver, see BFDeviceEvents.h
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+#include <exception>
+
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+#include <epicsStdio.h>
+
+#include <ADGenICam.h>
+
+#include "BFFeature.h"
+#include "ADBitFlow.h"
+#include "BFDeviceEvents.h"
+
+#ifdef BF_GENTL_EVENTS
+#include <GenICamUtilities.h>
+#include <BFResolveGenTL.h>
+#if GENTL_H_AT_LEAST_V(1,5,0)
+    using namespace GenTL;
+#else
+    using namespace GenICam::Client;
+#endif
+#endif
+
+static const char *driverName = "BFDeviceEvents";
+
+#ifdef BF_GENTL_EVENTS
+
+/** The GenTL producer and the handles opened on it */
+struct BFGenTL {
+    BFGenTL() : libOpen(false), hTL(0), hIf(0), hDev(0), hDeviceEvent(0), hInvalidateEvent(0),
+                deviceEventSize(0), invalidateEventSize(0) {}
+    GenTL_CTI::Ptr cti;
+    bool libOpen;
+    TL_HANDLE hTL;
+    IF_HANDLE hIf;
+    DEV_HANDLE hDev;
+    EVENT_HANDLE hDeviceEvent;
+    EVENT_HANDLE hInvalidateEvent;
+    size_t deviceEventSize;
+    size_t invalidateEventSize;
+};
+
+struct BFEventThreadArgs {
+    BFDeviceEvents *pEvents;
+    int eventType;
+};
+
+static void eventThreadC(void *arg)
+{
+    BFEventThreadArgs *pArgs = (BFEventThreadArgs *)arg;
+    pArgs->pEvents->eventThread(pArgs->eventType);
+    delete pArgs;
+}
+
+/** Returns true if path contains "bitflow", ignoring case.  GenTL_CTI_string is a wide string on Windows. */
+template <typename S>
+static bool isBitFlowProducer(S const & path)
+{
+    static const char key[] = "bitflow";
+    size_t keyLen = sizeof(key) - 1;
+    for (size_t i=0; i+keyLen<=path.size(); i++) {
+        size_t j = 0;
+        while ((j < keyLen) && (tolower((int)path[i+j]) == key[j])) j++;
+        if (j == keyLen) return true;
+    }
+    return false;
+}
+
+/** Registers an event on the device and returns the maximum size of its data, 0 if it cannot be registered */
+static size_t registerEvent(BFGenTL *p, EVENT_TYPE eventType, EVENT_HANDLE *phEvent, const char *eventName)
+{
+    static const char *functionName = "registerEvent";
+    INFO_DATATYPE infoType;
+    size_t sizeMax = 0;
+    size_t size = sizeof(sizeMax);
+
+    if (p->cti->GCRegisterEvent(p->hDev, eventType, phEvent) != GC_ERR_SUCCESS) {
+        printf("%s::%s cannot register %s\n", driverName, functionName, eventName);
+        *phEvent = 0;
+        return 0;
+    }
+    if ((p->cti->EventGetInfo(*phEvent, EVENT_SIZE_MAX, &infoType, &sizeMax, &size) != GC_ERR_SUCCESS) || (sizeMax == 0)) {
+        printf("%s::%s cannot read EVENT_SIZE_MAX of %s\n", driverName, functionName, eventName);
+        p->cti->GCUnregisterEvent(p->hDev, eventType);
+        *phEvent = 0;
+        return 0;
+    }
+    return sizeMax;
+}
+
+/** Unregisters the events and closes the device, interface, transport layer and producer */
+static void closeGenTL(BFGenTL *p)
+{
+    if (p->hDeviceEvent) p->cti->GCUnregisterEvent(p->hDev, EVENT_REMOTE_DEVICE);
+    if (p->hInvalidateEvent) p->cti->GCUnregisterEvent(p->hDev, EVENT_FEATURE_INVALIDATE);
+    if (p->hDev) p->cti->DevClose(p->hDev);
+    if (p->hIf) p->cti->IFClose(p->hIf);
+    if (p->hTL) p->cti->TLClose(p->hTL);
+    if (p->libOpen) p->cti->GCCloseLib();
+    p->hDeviceEvent = p->hInvalidateEvent = 0;
+    p->hDev = 0;
+    p->hIf = 0;
+    p->hTL = 0;
+    p->libOpen = false;
+}
+
+/** Opens the producer and the device read-only, the driver controls the camera through BFGTLUtil.
+  * Returns 0 on success.
+  */
+static int openGenTL(BFGenTL *p, const char *ctiFile, int interfaceIndex, int deviceIndex)
+{
+    static const char *functionName = "openGenTL";
+    size_t size = 0;
+
+    std::vector<GenTL_CTI_string> fileList;
+    GenTL_CTI_string ctiPath;
+    if (ctiFile && strlen(ctiFile)) {
+        ctiPath = GenTL_CTI_string(ctiFile, ctiFile + strlen(ctiFile));
+    } else {
+        if (!GenTL_CTI::findCtiFiles(fileList)) {
+            printf("%s::%s there are no CTI files installed on this system\n", driverName, functionName);
+            return -1;
+        }
+        ctiPath = fileList[0];
+        for (size_t i=0; i<fileList.size(); i++) {
+            if (isBitFlowProducer(fileList[i])) {
+                ctiPath = fileList[i];
+                break;
+            }
+        }
+    }
+    p->cti = GenTL_CTI::openCtiFilePath(ctiPath);
+    if (!p->cti) {
+        printf("%s::%s the CTI file could not be opened as a GenTL producer\n", driverName, functionName);
+        return -1;
+    }
+    if (p->cti->GCInitLib() != GC_ERR_SUCCESS) {
+        printf("%s::%s unable to initialize the GenTL producer library\n", driverName, functionName);
+        return -1;
+    }
+    p->libOpen = true;
+    if (p->cti->TLOpen(&p->hTL) != GC_ERR_SUCCESS) {
+        printf("%s::%s unable to open the transport layer\n", driverName, functionName);
+        return -1;
+    }
+    if (p->cti->TLUpdateInterfaceList(p->hTL, NULL, GENTL_INFINITE) != GC_ERR_SUCCESS) {
+        printf("%s::%s unable to update the interface list\n", driverName, functionName);
+        return -1;
+    }
+    if ((p->cti->TLGetInterfaceID(p->hTL, interfaceIndex, 0, &size) != GC_ERR_SUCCESS) || (size == 0)) {
+        printf("%s::%s there is no interface %d\n", driverName, functionName, interfaceIndex);
+        return -1;
+    }
+    std::vector<char> interfaceID(size);
+    if ((p->cti->TLGetInterfaceID(p->hTL, interfaceIndex, interfaceID.data(), &size) != GC_ERR_SUCCESS) ||
+        (p->cti->TLOpenInterface(p->hTL, interfaceID.data(), &p->hIf) != GC_ERR_SUCCESS)) {
+        printf("%s::%s unable to open interface %d\n", driverName, functionName, interfaceIndex);
+        return -1;
+    }
+    if (p->cti->IFUpdateDeviceList(p->hIf, NULL, GENTL_INFINITE) != GC_ERR_SUCCESS) {
+        printf("%s::%s unable to update the device list\n", driverName, functionName);
+        return -1;
+    }
+    size = 0;
+    if ((p->cti->IFGetDeviceID(p->hIf, deviceIndex, 0, &size) != GC_ERR_SUCCESS) || (size == 0)) {
+        printf("%s::%s interface %s has no device %d\n", driverName, functionName, interfaceID.data(), deviceIndex);
+        return -1;
+    }
+    std::vector<char> deviceID(size);
+    if ((p->cti->IFGetDeviceID(p->hIf, deviceIndex, deviceID.data(), &size) != GC_ERR_SUCCESS) ||
+        (p->cti->IFOpenDevice(p->hIf, deviceID.data(), DEVICE_ACCESS_READONLY, &p->hDev) != GC_ERR_SUCCESS)) {
+        printf("%s::%s unable to open device %d of interface %s\n", driverName, functionName, deviceIndex, interfaceID.data());
+        return -1;
+    }
+    p->deviceEventSize = registerEvent(p, EVENT_REMOTE_DEVICE, &p->hDeviceEvent, "EVENT_REMOTE_DEVICE");
+    p->invalidateEventSize = registerEvent(p, EVENT_FEATURE_INVALIDATE, &p->hInvalidateEvent, "EVENT_FEATURE_INVALIDATE");
+    if (!p->hDeviceEvent && !p->hInvalidateEvent) return -1;
+    printf("%s::%s receiving events from device %s\n", driverName, functionName, deviceID.data());
+    return 0;
+}
+
+/** Reads one field of the data of an event, returns 0 on success */
+static int getEventField(BFGenTL *p, EVENT_HANDLE hEvent, std::vector<epicsUInt8> const & data, size_t dataSize,
+                         EVENT_DATA_INFO_CMD field, std::vector<epicsUInt8> & value)
+{
+    INFO_DATATYPE infoType;
+    size_t size = 0;
+
+    if (p->cti->EventGetDataInfo(hEvent, data.data(), dataSize, field, &infoType, NULL, &size) != GC_ERR_SUCCESS) return -1;
+    value.resize(size);
+    if (size == 0) return 0;
+    if (p->cti->EventGetDataInfo(hEvent, data.data(), dataSize, field, &infoType, value.data(), &size) != GC_ERR_SUCCESS) return -1;
+    value.resize(size);
+    return 0;
+}
+
+#endif
+
+BFDeviceEvents::BFDeviceEvents(ADBitFlow *pDrv)
+    : pDrv_(pDrv), pGenTL_(0), deviceEvents_(0), invalidations_(0), threadsRunning_(0)
+{
+    threadDoneEventId_ = epicsEventCreate(epicsEventEmpty);
+}
+
+BFDeviceEvents::~BFDeviceEvents()
+{
+    stop();
+    epicsEventDestroy(threadDoneEventId_);
+}
+
+/** Opens the device through the GenTL producer and starts the event threads.
+  * \param[in] ctiFile Path of the producer's CTI file, empty or NULL to use the BitFlow producer found on the system
+  * \param[in] interfaceIndex GenTL interface, i.e. frame grabber, of the camera
+  * \param[in] deviceIndex Device on the interface
+  * Returns 0 on success.
+  */
+int BFDeviceEvents::start(const char *ctiFile, int interfaceIndex, int deviceIndex)
+{
+    static const char *functionName = "start";
+
+#ifdef BF_GENTL_EVENTS
+    if (pGenTL_) {
+        printf("%s::%s device events are already started\n", driverName, functionName);
+        return -1;
+    }
+    BFGenTL *p = new BFGenTL();
+    int status;
+    // The GenTL_CTI functions throw if the producer does not export them
+    try {
+        status = openGenTL(p, ctiFile, interfaceIndex, deviceIndex);
+        if (status) closeGenTL(p);
+    }
+    catch (std::exception const & e) {
+        printf("%s::%s the GenTL_CTI library threw an exception: %s\n", driverName, functionName, e.what());
+        try { closeGenTL(p); } catch (...) {}
+        status = -1;
+    }
+    if (status) {
+        delete p;
+        return -1;
+    }
+    pGenTL_ = p;
+    int eventTypes[] = {EVENT_REMOTE_DEVICE, EVENT_FEATURE_INVALIDATE};
+    EVENT_HANDLE handles[] = {p->hDeviceEvent, p->hInvalidateEvent};
+    for (int i=0; i<2; i++) {
+        if (!handles[i]) continue;
+        BFEventThreadArgs *pArgs = new BFEventThreadArgs;
+        pArgs->pEvents = this;
+        pArgs->eventType = eventTypes[i];
+        epicsAtomicIncrIntT(&threadsRunning_);
+        epicsThreadCreate("ADBFEventThread",
+                          epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          eventThreadC, pArgs);
+    }
+    return 0;
+#else
+    printf("%s::%s GenTL events are not enabled, rebuild with -DBF_GENTL_EVENTS\n", driverName, functionName);
+    return -1;
+#endif
+}
+
+/** Stops the event threads and closes the device.  This must not be called with the driver lock held,
+  * the event threads take it to deliver the events.
+  */
+void BFDeviceEvents::stop()
+{
+#ifdef BF_GENTL_EVENTS
+    if (!pGenTL_) return;
+    try {
+        if (pGenTL_->hDeviceEvent) pGenTL_->cti->EventKill(pGenTL_->hDeviceEvent);
+        if (pGenTL_->hInvalidateEvent) pGenTL_->cti->EventKill(pGenTL_->hInvalidateEvent);
+    }
+    catch (...) {}
+    while (epicsAtomicGetIntT(&threadsRunning_) > 0) {
+        epicsEventWait(threadDoneEventId_);
+    }
+    try { closeGenTL(pGenTL_); } catch (...) {}
+    delete pGenTL_;
+    pGenTL_ = 0;
+#endif
+}
+
+bool BFDeviceEvents::isRunning()
+{
+    return pGenTL_ != 0;
+}
+
+int BFDeviceEvents::getDeviceEvents()
+{
+    return epicsAtomicGetIntT(&deviceEvents_);
+}
+
+int BFDeviceEvents::getInvalidations()
+{
+    return epicsAtomicGetIntT(&invalidations_);
+}
+
+/** Waits for the events of one type until stop() kills the wait.
+  * EVENT_FEATURE_INVALIDATE carries the name of the feature in EVENT_DATA_ID.  EVENT_REMOTE_DEVICE carries
+  * the CoaXPress event message in EVENT_DATA_VALUE, the event ID is the low 12 bits of its first word
+  * (see execEventViewer in exampleSrc) and is delivered to the driver as "Device:0x<id>".
+  */
+void BFDeviceEvents::eventThread(int eventType)
+{
+#ifdef BF_GENTL_EVENTS
+    static const char *functionName = "eventThread";
+    bool invalidate = (eventType == EVENT_FEATURE_INVALIDATE);
+    EVENT_HANDLE hEvent = invalidate ? pGenTL_->hInvalidateEvent : pGenTL_->hDeviceEvent;
+    std::vector<epicsUInt8> data(invalidate ? pGenTL_->invalidateEventSize : pGenTL_->deviceEventSize);
+    std::vector<epicsUInt8> field;
+
+    try {
+        for (;;) {
+            size_t size = data.size();
+            GC_ERROR err = pGenTL_->cti->EventGetData(hEvent, data.data(), &size, GENTL_INFINITE);
+            if (err == GC_ERR_ABORT) break;
+            if (err != GC_ERR_SUCCESS) {
+                printf("%s::%s EventGetData error=%d\n", driverName, functionName, (int)err);
+                epicsThreadSleep(0.1);
+                continue;
+            }
+            if (invalidate) {
+                if (getEventField(pGenTL_, hEvent, data, size, EVENT_DATA_ID, field) || field.empty()) continue;
+                field.push_back(0);
+                std::string featureName((const char *)field.data());
+                epicsAtomicIncrIntT(&invalidations_);
+                pDrv_->featureInvalidated(featureName.c_str());
+            } else {
+                if (getEventField(pGenTL_, hEvent, data, size, EVENT_DATA_VALUE, field)) continue;
+                if (field.size() < 3*sizeof(epicsUInt32)) continue;
+                epicsUInt32 header;
+                memcpy(&header, field.data(), sizeof(header));
+                char eventName[32];
+                epicsSnprintf(eventName, sizeof(eventName), "Device:0x%x", (unsigned)(header & 0xfff));
+                epicsAtomicIncrIntT(&deviceEvents_);
+                pDrv_->deviceEvent(eventName);
+            }
+        }
+    }
+    catch (std::exception const & e) {
+        printf("%s::%s the GenTL_CTI library threw an exception: %s\n", driverName, functionName, e.what());
+    }
+#endif
+    epicsAtomicDecrIntT(&threadsRunning_);
+    epicsEventSignal(threadDoneEventId_);
+}
@@ -0,0 +1,38 @@
+// BFDeviceEvents.h
+// GenTL device events and feature invalidations delivered to the driver.
+//
+// BFGTLUtil has no event registration, so the camera is also opened through the BitFlow GenTL
+// producer, read-only, in the same way as exampleSrc/GenTLInterfaceExample.  Its EVENT_REMOTE_DEVICE
+// and EVENT_FEATURE_INVALIDATE events are waited for by two threads that pass them to the driver.
+// This is only compiled when BF_GENTL_EVENTS is defined (see Makefile), because it links the GenTL
+// interface library and GenApi.
+
+#ifndef BF_DEVICE_EVENTS_H
+#define BF_DEVICE_EVENTS_H
+
+#include <epicsEvent.h>
+
+class ADBitFlow;
+struct BFGenTL;
+
+class BFDeviceEvents {
+public:
+    BFDeviceEvents(ADBitFlow *pDrv);
+    ~BFDeviceEvents();
+    int start(const char *ctiFile, int interfaceIndex, int deviceIndex);
+    void stop(void);
+    bool isRunning(void);
+    int getDeviceEvents(void);
+    int getInvalidations(void);
+    void eventThread(int eventType);
+
+private:
+    ADBitFlow *pDrv_;
+    BFGenTL *pGenTL_;
+    int deviceEvents_;
+    int invalidations_;
+    int threadsRunning_;
+    epicsEventId threadDoneEventId_;
+};
+
+#endif
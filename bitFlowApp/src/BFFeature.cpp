@@ -2,39 +2,394 @@
 // Mark Rivers
 // August 26, 2023
 
+#include <stdlib.h>
+#include <math.h>
+
+#include <epicsStdio.h>
+#include <epicsGuard.h>
+
 #include <BFFeature.h>
 #include <ADBitFlow.h>
+#include "BFFeatureMap.h"
 
 static const char *driverName="BFFeature";
 
+BFFeatureCache::BFFeatureCache()
+    : mGeneration(0), mMaxAge(1.0), mHits(0), mMisses(0)
+{
+}
+
+/** Called after any write to a feature, the write may have changed the access mode or limits of other features */
+void BFFeatureCache::invalidate()
+{
+    mGeneration++;
+}
+
+void BFFeatureCache::setMaxAge(double maxAge)
+{
+    mMaxAge = maxAge;
+    invalidate();
+}
+
+int BFFeatureCache::getHits()
+{
+    return mHits;
+}
+
+int BFFeatureCache::getMisses()
+{
+    return mMisses;
+}
+
+unsigned BFFeatureCache::getGeneration()
+{
+    return mGeneration;
+}
+
+bool BFFeatureCache::isCurrent(unsigned generation, epicsTimeStamp const & time)
+{
+    if (generation != mGeneration) return false;
+    if (mMaxAge <= 0) return false;
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    return (epicsTimeDiffInSeconds(&now, &time) < mMaxAge);
+}
+
+BFControlStats::BFControlStats()
+    : mReads(0), mWrites(0), mTime(0.), mReadLatency(1024), mWriteLatency(1024)
+{
+}
+
+/** Records one transaction of a feature */
+void BFControlStats::add(BFNodeStats & node, bool isWrite, double seconds)
+{
+    epicsGuard<epicsMutex> guard(mMutex);
+    if (isWrite) {
+        node.writes++;
+        node.writeTime += seconds;
+        mWrites++;
+        mWriteLatency.add(seconds*1000.);
+    } else {
+        node.reads++;
+        node.readTime += seconds;
+        mReads++;
+        mReadLatency.add(seconds*1000.);
+    }
+    if (seconds > node.maxTime) node.maxTime = seconds;
+    mTime += seconds;
+}
+
+/** Clears the totals.  The caller clears the BFNodeStats of the features while holding lock(). */
+void BFControlStats::reset()
+{
+    epicsGuard<epicsMutex> guard(mMutex);
+    mReads = 0;
+    mWrites = 0;
+    mTime = 0.;
+    mReadLatency.reset();
+    mWriteLatency.reset();
+}
+
+/** Must be held while reading the BFNodeStats of the features */
+void BFControlStats::lock()
+{
+    mMutex.lock();
+}
+
+void BFControlStats::unlock()
+{
+    mMutex.unlock();
+}
+
+int BFControlStats::getReads()
+{
+    return mReads;
+}
+
+int BFControlStats::getWrites()
+{
+    return mWrites;
+}
+
+/** Returns the total time spent in transactions in seconds */
+double BFControlStats::getTime()
+{
+    return mTime;
+}
+
+/** Returns the read latency percentiles in ms */
+void BFControlStats::getReadPercentiles(double *p50, double *p99, double *max)
+{
+    epicsGuard<epicsMutex> guard(mMutex);
+    mReadLatency.getPercentiles(p50, p99, max);
+}
+
+/** Returns the write latency percentiles in ms */
+void BFControlStats::getWritePercentiles(double *p50, double *p99, double *max)
+{
+    epicsGuard<epicsMutex> guard(mMutex);
+    mWriteLatency.getPercentiles(p50, p99, max);
+}
+
 BFFeature::BFFeature(GenICamFeatureSet *set, 
                      std::string const & asynName, asynParamType asynType, int asynIndex,
                      std::string const & featureName, GCFeatureType_t featureType)
                      
          : GenICamFeature(set, asynName, asynType, asynIndex, featureName, featureType),
-         mAsynUser(set->getUser())
+         mAsynUser(set->getUser()), mNode(0), mNodeType(), mIsImplemented(false), mResolved(false),
+         mPollClass(BFPollAuto), mPolled(false), mPollGeneration(0), mEventPending(false), mEnumEntriesRead(false), mFromMap(false),
+         mOffLockCalls(0), mRetiredNode(0), mPrefetched(false),
+         mReadDouble(&BFFeature::readFloat), mReadDoubleMin(&BFFeature::readFloatMin),
+         mReadDoubleMax(&BFFeature::readFloatMax), mWriteDouble(&BFFeature::writeFloat)
 {
-    static const char *functionName = "BFFeature";
-    int err;
-
     mNodeName = featureName;
-    const char *nodeNameStr = mNodeName.c_str();
     ADBitFlow *pDrv = (ADBitFlow *) mSet->getPortDriver();
     mDev = pDrv->getBFGTLDev();
-    mIsImplemented = (bool)BFGTLDevNodeExists(mDev, nodeNameStr);
-    if (!mIsImplemented) return;
-    err = BFGTLNodeOpen(mDev, nodeNameStr, &mNode);
+    mCache = pDrv->getFeatureCache();
+    mControlStats = pDrv->getControlStats();
+}
+
+BFFeature::~BFFeature()
+{
+    closeEnumEntries();
+    if (mNode) BFGTLNodeClose(mNode);
+    if (mRetiredNode) BFGTLNodeClose(mRetiredNode);
+}
+
+/** Opens the GenICam node and reads its type.
+  * This is not done in the constructor because with several hundred features the control channel
+  * round trips made IOC startup take many seconds.  It is called on the first access to the feature,
+  * or for all features by the driver's background thread after iocInit.
+  */
+void BFFeature::resolve()
+{
+    static const char *functionName = "resolve";
+
+    if (mResolved) return;
+    mResolved = true;
+    epicsTimeStamp startTime, endTime;
+    epicsTimeGetCurrent(&startTime);
+    ADBitFlow *pDrv = (ADBitFlow *) mSet->getPortDriver();
+    BFFeatureMap *pMap = pDrv->getFeatureMap();
+    BFNodeInfo const *pInfo = pMap->find(mNodeName);
+    if (pInfo) {
+        // Trust the saved map for now, resolveFeaturesThread calls validate() once the IOC is running
+        mFromMap = true;
+        mIsImplemented = pInfo->exists;
+        mNodeType = (BFGTLNodeType)pInfo->type;
+        if (mIsImplemented) {
+            openNode(functionName);
+            mCache->store(mAccess, (BFGTLUtilU32)pInfo->access);
+        }
+    } else {
+        mIsImplemented = (bool)BFGTLDevNodeExists(mDev, mNodeName.c_str());
+        if (mIsImplemented) {
+            openNode(functionName);
+            mNodeType = readNodeType(functionName);
+        }
+        if (pMap->isEnabled()) {
+            BFNodeInfo info;
+            info.exists = mIsImplemented;
+            info.type = mNodeType;
+            if (mIsImplemented) info.access = readAccess(functionName);
+            pMap->update(mNodeName, info);
+        }
+    }
+    if (mPollClass == BFPollAuto) {
+        // Only the autogenerated GenICam parameters are polled, ADGenICam converts the units of
+        // the features it maps to ADDriver parameters (e.g. ExposureTime to ADAcquireTime)
+        BFGTLUtilU32 access = mIsImplemented ? readAccess(functionName) : BFGTL_ACCESS_NA;
+        if (!mIsImplemented || (mNodeType == BFGTL_NODE_TYPE_COMMAND) || (mAsynName.compare(0, 3, "GC_") != 0) ||
+            (access == BFGTL_ACCESS_NA) || (access == BFGTL_ACCESS_WO)) {
+            mPollClass = BFPollNever;
+        } else if (access == BFGTL_ACCESS_RW) {
+            mPollClass = BFPollOnChange;
+        } else if (mNodeType == BFGTL_NODE_TYPE_STRING) {
+            mPollClass = BFPollStatic;
+        } else {
+            mPollClass = BFPollFast;
+        }
+    }
+    if (mIsImplemented) bindAccessors();
+    epicsTimeGetCurrent(&endTime);
+    pDrv->featureResolved(epicsTimeDiffInSeconds(&endTime, &startTime));
+}
+
+void BFFeature::openNode(const char *functionName)
+{
+    int err = BFGTLNodeOpen(mDev, mNodeName.c_str(), &mNode);
     if (err) {
-        printf("%s::%s error creating node %s, error=%d\n", driverName, functionName, nodeNameStr, err);
+        printf("%s::%s error creating node %s, error=%d\n", driverName, functionName, mNodeName.c_str(), err);
     }
-    BFGTLUtilU32 value;
+}
+
+BFGTLNodeType BFFeature::readNodeType(const char *functionName)
+{
+    BFGTLUtilU32 value = 0;
     size_t size = sizeof(value);
-    err = BFGTLNodeRead(mNode, BFGTL_NODE_TYPE, &value, &size);
+    int err = nodeRead(mNode, BFGTL_NODE_TYPE, &value, &size);
     if (err) {
-        printf("%s::%s error reading node type %s, error=%d\n", driverName, functionName, nodeNameStr, err);
+        printf("%s::%s error reading node type %s, error=%d\n", driverName, functionName, mNodeName.c_str(), err);
     }
-    mNodeType = (BFGTLNodeType)value; 
- }
+    return (BFGTLNodeType)value;
+}
+
+/** Binds the double accessors to the node type, and checks the node type against the feature type
+  * once, so that the accessors do not check it on every call.
+  */
+void BFFeature::bindAccessors()
+{
+    static const char *functionName = "bindAccessors";
+    bool compatible;
+
+    // The Mikrotron cameras use integer node types for ExposureTime and AcquisitionFrameRate but ADGenICam
+    // expects these to be float nodes, the double accessors of these features convert from the integer node.
+    if (mNodeType == BFGTL_NODE_TYPE_INTEGER) {
+        mReadDouble    = &BFFeature::readIntegerAsDouble;
+        mReadDoubleMin = &BFFeature::readIntegerMinAsDouble;
+        mReadDoubleMax = &BFFeature::readIntegerMaxAsDouble;
+        mWriteDouble   = &BFFeature::writeDoubleAsInteger;
+    } else {
+        mReadDouble    = &BFFeature::readFloat;
+        mReadDoubleMin = &BFFeature::readFloatMin;
+        mReadDoubleMax = &BFFeature::readFloatMax;
+        mWriteDouble   = &BFFeature::writeFloat;
+    }
+    switch (mFeatureType) {
+      case GCFeatureTypeInteger:
+        compatible = (mNodeType == BFGTL_NODE_TYPE_INTEGER);
+        break;
+      case GCFeatureTypeBoolean:
+        compatible = (mNodeType == BFGTL_NODE_TYPE_BOOLEAN);
+        break;
+      case GCFeatureTypeDouble:
+        compatible = (mNodeType == BFGTL_NODE_TYPE_FLOAT) || (mNodeType == BFGTL_NODE_TYPE_INTEGER);
+        break;
+      case GCFeatureTypeEnum:
+        compatible = (mNodeType == BFGTL_NODE_TYPE_ENUMERATION);
+        break;
+      case GCFeatureTypeString:
+        compatible = (mNodeType == BFGTL_NODE_TYPE_STRING);
+        break;
+      case GCFeatureTypeCmd:
+        compatible = (mNodeType == BFGTL_NODE_TYPE_COMMAND);
+        break;
+      default:
+        compatible = true;
+        break;
+    }
+    if (!compatible) {
+        printf("%s::%s warning node %s type=%d does not match feature type=%d\n",
+            driverName, functionName, mNodeName.c_str(), mNodeType, mFeatureType);
+    }
+}
+
+/** Checks the existence, type, access mode and enumeration entries loaded from the feature map against the camera.
+  * Called by resolveFeaturesThread with the lock held after the IOC is running.  If they differ the
+  * camera wins, the feature and the map are corrected and false is returned.
+  */
+bool BFFeature::validate()
+{
+    static const char *functionName = "validate";
+
+    resolve();
+    if (!mFromMap) return true;
+    mFromMap = false;
+    ADBitFlow *pDrv = (ADBitFlow *) mSet->getPortDriver();
+    BFFeatureMap *pMap = pDrv->getFeatureMap();
+    BFNodeInfo const *pInfo = pMap->find(mNodeName);
+    bool hadEntries = pInfo && pInfo->hasEntries;
+    std::vector<BFNodeEntryInfo> mapEntries;
+    if (hadEntries) mapEntries = pInfo->entries;
+    BFGTLUtilU32 mapAccess = pInfo ? (BFGTLUtilU32)pInfo->access : BFGTL_ACCESS_NA;
+
+    bool exists = (bool)BFGTLDevNodeExists(mDev, mNodeName.c_str());
+    if (exists && !mIsImplemented) openNode(functionName);
+    BFGTLNodeType nodeType = exists ? readNodeType(functionName) : mNodeType;
+    BFGTLUtilU32 access = BFGTL_ACCESS_NA;
+    if (exists) {
+        size_t size = sizeof(access);
+        if (checkError(nodeRead(mNode, BFGTL_NODE_ACCESS, &access, &size), functionName, "BFGTLNodeRead BFGTL_NODE_ACCESS")) {
+            access = mapAccess;
+        }
+    }
+    bool matches = (exists == mIsImplemented) && (nodeType == mNodeType) && (!exists || (access == mapAccess));
+    std::vector<BFNodeEntryInfo> entries;
+    std::vector<BFGTLNode> handles;
+    bool entriesComplete = false;
+    if (matches && hadEntries) {
+        entriesComplete = readCameraEntries(entries, handles);
+        matches = entriesComplete && (entries.size() == mapEntries.size());
+        for (size_t i=0; matches && i<entries.size(); i++) {
+            matches = (entries[i].name == mapEntries[i].name) && (entries[i].value == mapEntries[i].value) &&
+                      (entries[i].symbolic == mapEntries[i].symbolic);
+        }
+    }
+    if (matches) {
+        // The entry handles are kept if the table has not been read yet, saving the opens later
+        if (!handles.empty() && !mEnumEntriesRead) {
+            setEnumEntries(entries, handles);
+        } else {
+            for (size_t i=0; i<handles.size(); i++) BFGTLNodeClose(handles[i]);
+        }
+        return true;
+    }
+    asynPrint(mAsynUser, ASYN_TRACE_WARNING,
+        "%s::%s nodeName=%s feature map had exists=%d type=%d access=%u, camera has exists=%d type=%d access=%u\n",
+        driverName, functionName, mNodeName.c_str(), mIsImplemented, mNodeType, mapAccess, exists, nodeType, access);
+    if (!exists && mIsImplemented) retireNode();
+    mIsImplemented = exists;
+    mNodeType = nodeType;
+    if (mIsImplemented) bindAccessors();
+    mCache->invalidate();
+    closeEnumEntries();
+    BFNodeInfo info;
+    info.exists = mIsImplemented;
+    info.type = mNodeType;
+    info.access = access;
+    pMap->update(mNodeName, info);
+    // A complete table read here is saved, otherwise the entries are rediscovered on the next access
+    if (entriesComplete) {
+        pMap->updateEntries(mNodeName, entries);
+    } else {
+        pMap->eraseEntries(mNodeName);
+    }
+    for (size_t i=0; i<handles.size(); i++) BFGTLNodeClose(handles[i]);
+    return false;
+}
+
+/** Marks the start of a poll() or performWrite() call made without the driver lock.  Called with the lock held. */
+void BFFeature::beginOffLock()
+{
+    mOffLockCalls++;
+}
+
+/** Marks the end of a call started with beginOffLock(), closing a node handle that validate() retired
+  * while the call was in flight.  Called with the lock held.
+  */
+void BFFeature::endOffLock()
+{
+    if ((--mOffLockCalls == 0) && mRetiredNode) {
+        BFGTLNodeClose(mRetiredNode);
+        mRetiredNode = 0;
+    }
+}
+
+/** Closes mNode, or defers closing it to endOffLock() if poll() or performWrite() may be using it
+  * without the lock.  Called with the lock held.
+  */
+void BFFeature::retireNode()
+{
+    BFGTLNode hNode = mNode;
+    mNode = 0;
+    if (!hNode) return;
+    if (mOffLockCalls == 0) {
+        BFGTLNodeClose(hNode);
+    } else {
+        if (mRetiredNode) BFGTLNodeClose(mRetiredNode);
+        mRetiredNode = hNode;
+    }
+}
 
 inline asynStatus BFFeature::checkError(int error, const char *functionName, const char *BFFunction)
 {
@@ -47,153 +402,248 @@ inline asynStatus BFFeature::checkError(int error, const char *functionName, con
     return asynSuccess;
 }
 
+template <typename T>
+T BFFeature::readCached(BFCachedValue<T> & entry, BFGTLNodeInfo info, const char *functionName) {
+    if (mCache->lookup(entry)) return entry.value;
+    T value = T();
+    size_t size = sizeof(value);
+    if (checkError(nodeRead(mNode, info, &value, &size), functionName, "BFGTLNodeRead") == asynSuccess) {
+        mCache->store(entry, value);
+    }
+    return value;
+}
+
+/** BFGTLNodeRead timed and counted in the control channel statistics */
+int BFFeature::nodeRead(BFGTLNode hNode, BFGTLNodeInfo info, void *pValue, size_t *pSize) {
+    epicsTimeStamp startTime, endTime;
+    epicsTimeGetCurrent(&startTime);
+    int err = BFGTLNodeRead(hNode, info, pValue, pSize);
+    epicsTimeGetCurrent(&endTime);
+    mControlStats->add(mNodeStats, false, epicsTimeDiffInSeconds(&endTime, &startTime));
+    return err;
+}
+
+/** BFGTLNodeWrite timed and counted in the control channel statistics */
+int BFFeature::nodeWrite(BFGTLNode hNode, BFGTLNodeInfo info, const void *pValue, size_t size) {
+    epicsTimeStamp startTime, endTime;
+    epicsTimeGetCurrent(&startTime);
+    int err = BFGTLNodeWrite(hNode, info, pValue, size);
+    epicsTimeGetCurrent(&endTime);
+    mControlStats->add(mNodeStats, true, epicsTimeDiffInSeconds(&endTime, &startTime));
+    return err;
+}
+
+/** Returns the control channel statistics of this feature, the caller must hold BFControlStats::lock() */
+BFNodeStats & BFFeature::getNodeStats() {
+    return mNodeStats;
+}
+
+BFGTLUtilU32 BFFeature::readAccess(const char *functionName) {
+    return readCached(mAccess, BFGTL_NODE_ACCESS, functionName);
+}
+
+/** Writes a value, either now or through the driver's control thread when asynchronous writes are enabled */
+void BFFeature::write(BFWriteType_t type, BFFeatureValue const & value) {
+    ADBitFlow *pDrv = (ADBitFlow *) mSet->getPortDriver();
+    if (pDrv->queueWrite(this, type, value)) return;
+    epicsTimeStamp startTime, endTime;
+    epicsTimeGetCurrent(&startTime);
+    performWrite(type, value);
+    epicsTimeGetCurrent(&endTime);
+    mCache->invalidate();
+    pDrv->writeDone(epicsTimeDiffInSeconds(&endTime, &startTime));
+}
+
+/** Writes a value to the node.  This is called by the control thread without the driver lock,
+  * it only uses mNode, which validate() does not close while the call is in flight (see beginOffLock()).
+  */
+asynStatus BFFeature::performWrite(BFWriteType_t type, BFFeatureValue const & value) {
+    static const char *functionNames[] = {"writeInteger", "writeBoolean", "writeDouble", "writeString", "writeCommand"};
+    int err;
+    switch (type) {
+      case BFWriteInteger: {
+        epicsInt64 iVal = value.intValue;
+        err = nodeWrite(mNode, BFGTL_NODE_VALUE, &iVal, sizeof(iVal));
+        break;
+      }
+      case BFWriteBoolean: {
+        BFGTLUtilBool bVal = value.intValue ? 1 : 0;
+        err = nodeWrite(mNode, BFGTL_NODE_VALUE, &bVal, sizeof(bVal));
+        break;
+      }
+      case BFWriteDouble: {
+        double dVal = value.doubleValue;
+        err = nodeWrite(mNode, BFGTL_NODE_VALUE, &dVal, sizeof(dVal));
+        break;
+      }
+      case BFWriteString:
+        err = nodeWrite(mNode, BFGTL_NODE_VALUE, value.stringValue.c_str(), value.stringValue.size() + 1);
+        break;
+      default:
+        err = nodeWrite(mNode, BFGTL_NODE_VALUE, 0, 0);
+        break;
+    }
+    return checkError(err, functionNames[type], "BFGTLNodeWrite");
+}
+
 bool BFFeature::isImplemented() { 
+    resolve();
     return mIsImplemented; 
 }
 
 bool BFFeature::isAvailable() {
-    BFGTLUtilU32 value;
-    size_t size = sizeof(value);
-    if (!mIsImplemented) return false;
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_ACCESS, &value, &size), "isAvailable", "BFGTLNodeRead");
+    if (!isImplemented()) return false;
+    BFGTLUtilU32 value = readAccess("isAvailable");
     return (value == BFGTL_ACCESS_NA) ? false : true;
  }
 
 bool BFFeature::isReadable() { 
-    BFGTLUtilU32 value;
-    size_t size = sizeof(value);
-    if (!mIsImplemented) return false;
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_ACCESS, &value, &size), "isReadable", "BFGTLNodeRead");
+    if (!isImplemented()) return false;
+    BFGTLUtilU32 value = readAccess("isReadable");
     return ((value == BFGTL_ACCESS_RO) || (value == BFGTL_ACCESS_RW)) ? true : false;
 }
 
 bool BFFeature::isWritable() { 
-    BFGTLUtilU32 value;
-    size_t size = sizeof(value);
-    if (!mIsImplemented) return false;
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_ACCESS, &value, &size), "isWritable", "BFGTLNodeRead");
+    if (!isImplemented()) return false;
+    BFGTLUtilU32 value = readAccess("isWritable");
     //printf("BFFeature::isWritable nodeName=%s, access=%d\n", mNodeName.c_str(), value);
     return ((value == BFGTL_ACCESS_WO) || (value == BFGTL_ACCESS_RW)) ? true : false;
 }
 
 epicsInt64 BFFeature::readInteger() {
+    resolve();
+    if (mPrefetched) return mPrefetch.intValue;
     epicsInt64 value;
     size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_INTEGER) printf("BFFeature::readInteger warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readInteger", "BFGTLNodeRead");
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readInteger", "BFGTLNodeRead");
     return value;
 }
 
 epicsInt64 BFFeature::readIntegerMin() {
-    epicsInt64 value;
-    size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_INTEGER) printf("BFFeature::readIntegerMin warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_MIN, &value, &size), "readIntegerMin", "BFGTLNodeRead");
-    return value;
+    resolve();
+    return readCached(mIntegerMin, BFGTL_NODE_MIN, "readIntegerMin");
 }
 
 epicsInt64 BFFeature::readIntegerMax() {
-    epicsInt64 value;
-    size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_INTEGER) printf("BFFeature::readIntegerMax warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_MAX, &value, &size), "readIntegerMax", "BFGTLNodeRead");
-    return value;
+    resolve();
+    return readCached(mIntegerMax, BFGTL_NODE_MAX, "readIntegerMax");
 }
 
 epicsInt64 BFFeature::readIncrement() { 
-    epicsInt64 value;
-    size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_INTEGER) printf("BFFeature::readIncrement warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_INC, &value, &size), "readIncrement", "BFGTLNodeRead");
-    return value;
+    resolve();
+    return readCached(mIncrement, BFGTL_NODE_INC, "readIncrement");
 }
 
 void BFFeature::writeInteger(epicsInt64 value) { 
-    size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_INTEGER) printf("BFFeature::writeInteger warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeWrite(mNode, BFGTL_NODE_VALUE, &value, size), "writeInteger", "BFGTLNodeWrite");
+    resolve();
+    BFFeatureValue fValue;
+    fValue.intValue = value;
+    write(BFWriteInteger, fValue);
 }
 
 bool BFFeature::readBoolean() { 
+    resolve();
+    if (mPrefetched) return mPrefetch.intValue != 0;
     BFGTLUtilBool value;
     size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_BOOLEAN) printf("BFFeature::readBoolean warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readBoolean", "BFGTLNodeRead");
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readBoolean", "BFGTLNodeRead");
     return (bool)value;
 }
 
 void BFFeature::writeBoolean(bool bval) {
-    BFGTLUtilBool value = bval;
-    size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_BOOLEAN) printf("BFFeature::writeBoolean warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeWrite(mNode, BFGTL_NODE_VALUE, &value, size), "writeBoolean", "BFGTLNodeWrite");
+    resolve();
+    BFFeatureValue fValue;
+    fValue.intValue = bval;
+    write(BFWriteBoolean, fValue);
 }
 
-// The Mikrotron cameras use integer node types for ExposureTime and AcquisitionFrameRate but ADGenICam expects these to be float nodes.
-// These double methods need to handle integers
 double BFFeature::readDouble() {
-    if (mNodeType == BFGTL_NODE_TYPE_INTEGER) {
-        return (double)readInteger();
-    }
-    if (mNodeType != BFGTL_NODE_TYPE_FLOAT) printf("BFFeature::readDouble warning node type=%d\n", mNodeType);
-    double value;
-    size_t size = sizeof(value);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readDouble", "BFGTLNodeRead");
-    return value;
+    resolve();
+    if (mPrefetched) return mPrefetch.doubleValue;
+    return (this->*mReadDouble)();
 }
 
 void BFFeature::writeDouble(double value) { 
-    if (mNodeType == BFGTL_NODE_TYPE_INTEGER) {
-        writeInteger((epicsInt64)value);
-        return;
-    }
-    if (mNodeType != BFGTL_NODE_TYPE_FLOAT) printf("BFFeature::writeDouble warning node type=%d\n", mNodeType);
-    size_t size = sizeof(value);
-    checkError(BFGTLNodeWrite(mNode, BFGTL_NODE_VALUE, &value, size), "writeDouble", "BFGTLNodeWrite");
+    resolve();
+    (this->*mWriteDouble)(value);
 }
 
 double BFFeature::readDoubleMin() {
-    if (mNodeType == BFGTL_NODE_TYPE_INTEGER) {
-        return (double)readIntegerMin();
-    }
-    if (mNodeType != BFGTL_NODE_TYPE_FLOAT) printf("BFFeature::readDoubleMin warning node type=%d\n", mNodeType);
-    double value;    
-    size_t size = sizeof(value);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_MIN, &value, &size), "readDoubleMin", "BFGTLNodeRead");
-    return value;
+    resolve();
+    return (this->*mReadDoubleMin)();
 }
 
 double BFFeature::readDoubleMax() {
-    if (mNodeType == BFGTL_NODE_TYPE_INTEGER) {
-        return (double)readIntegerMax();
-    }
-    if (mNodeType != BFGTL_NODE_TYPE_FLOAT) printf("BFFeature::readDoubleMin warning node type=%d\n", mNodeType);
+    resolve();
+    return (this->*mReadDoubleMax)();
+}
+
+double BFFeature::readFloat() {
     double value;
     size_t size = sizeof(value);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_MAX, &value, &size), "readDoubleMax", "BFGTLNodeRead");
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readDouble", "BFGTLNodeRead");
     return value;
 }
 
+double BFFeature::readFloatMin() {
+    return readCached(mDoubleMin, BFGTL_NODE_MIN, "readDoubleMin");
+}
+
+double BFFeature::readFloatMax() {
+    return readCached(mDoubleMax, BFGTL_NODE_MAX, "readDoubleMax");
+}
+
+void BFFeature::writeFloat(double value) {
+    BFFeatureValue fValue;
+    fValue.doubleValue = value;
+    write(BFWriteDouble, fValue);
+}
+
+double BFFeature::readIntegerAsDouble() {
+    epicsInt64 value;
+    size_t size = sizeof(value);
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readDouble", "BFGTLNodeRead");
+    return (double)value;
+}
+
+double BFFeature::readIntegerMinAsDouble() {
+    return (double)readCached(mIntegerMin, BFGTL_NODE_MIN, "readDoubleMin");
+}
+
+double BFFeature::readIntegerMaxAsDouble() {
+    return (double)readCached(mIntegerMax, BFGTL_NODE_MAX, "readDoubleMax");
+}
+
+void BFFeature::writeDoubleAsInteger(double value) {
+    BFFeatureValue fValue;
+    fValue.intValue = (epicsInt64)value;
+    write(BFWriteInteger, fValue);
+}
+
 int BFFeature::readEnumIndex() { 
+    resolve();
+    if (mPrefetched) return (int)mPrefetch.intValue;
     epicsInt64 value;
     size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_ENUMERATION) printf("BFFeature::readEnumIndex warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readEnumIndex", "BFGTLNodeRead");
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE, &value, &size), "readEnumIndex", "BFGTLNodeRead");
     return (int) value;
 }
 
 void BFFeature::writeEnumIndex(int value) {
-    epicsInt64 iVal = value; 
-    size_t size = sizeof(iVal);
-    if (mNodeType != BFGTL_NODE_TYPE_ENUMERATION) printf("BFFeature::writeEnumIndex warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeWrite(mNode, BFGTL_NODE_VALUE, &iVal, size), "writeEnumIndex", "BFGTLNodeWrite");
+    resolve();
+    BFFeatureValue fValue;
+    fValue.intValue = value;
+    write(BFWriteInteger, fValue);
 }
 
 std::string BFFeature::readEnumString() { 
+    resolve();
+    for (size_t i=0; mPrefetched && i<mEnumEntries.size(); i++) {
+        if (mEnumEntries[i].value == mPrefetch.intValue) return mEnumEntries[i].symbolic;
+    }
     char value[256];
     size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_ENUMERATION) printf("BFFeature::readEnumString warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_VALUE_STR, value, &size), "readEnumString", "BFGTLNodeRead");
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE_STR, value, &size), "readEnumString", "BFGTLNodeRead");
     return value;
 }
 
@@ -201,48 +651,339 @@ void BFFeature::writeEnumString(std::string const &value) {
 }
 
 std::string BFFeature::readString() { 
+    resolve();
+    if (mPrefetched) return mPrefetch.stringValue;
     char value[256];
     size_t size = sizeof(value);
-    if (mNodeType != BFGTL_NODE_TYPE_STRING) printf("BFFeature::readString warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_VALUE, value, &size), "readString", "BFGTLNodeRead");
+    checkError(nodeRead(mNode, BFGTL_NODE_VALUE, value, &size), "readString", "BFGTLNodeRead");
     return value;
 }
 
 void BFFeature::writeString(std::string const & value) { 
-    size_t size = value.size() + 1;
-    if (mNodeType != BFGTL_NODE_TYPE_STRING) printf("BFFeature::writeString warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeWrite(mNode, BFGTL_NODE_VALUE, value.c_str(), size), "writeString", "BFGTLNodeWrite");
+    resolve();
+    BFFeatureValue fValue;
+    fValue.stringValue = value;
+    write(BFWriteString, fValue);
 }
 
 void BFFeature::writeCommand() {
-    if (mNodeType != BFGTL_NODE_TYPE_COMMAND) printf("BFFeature::writeCommand warning node type=%d\n", mNodeType);
-    checkError(BFGTLNodeWrite(mNode, BFGTL_NODE_VALUE, 0, 0), "writeCommand", "BFGTLNodeWrite");
+    resolve();
+    BFFeatureValue fValue;
+    write(BFWriteCommand, fValue);
 }
 
-void BFFeature::readEnumChoices(std::vector<std::string>& enumStrings, std::vector<int>& enumValues) {
-    if (mNodeType != BFGTL_NODE_TYPE_ENUMERATION) printf("BFFeature::readEnumChoices warning node type=%d\n", mNodeType);
+/** Reads the entry table of an enumeration from the camera and opens the entry nodes.
+  * Returns false if an entry node could not be opened, the table is then incomplete.
+  */
+bool BFFeature::readCameraEntries(std::vector<BFNodeEntryInfo> & entries, std::vector<BFGTLNode> & handles) {
     size_t size = 0;
+    bool complete = true;
     // The first call with BFGTL_NODE_ENTRY_NAMES is with pValue=0 so it just returns the required size in size;
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_ENTRY_NAMES, 0, &size), "readEnumChoices", "BFGTLNodeRead");
+    if (checkError(nodeRead(mNode, BFGTL_NODE_ENTRY_NAMES, 0, &size), "readEnumChoices", "BFGTLNodeRead")) return false;
     std::vector<char> entryNameTable(size);
-    checkError(BFGTLNodeRead(mNode, BFGTL_NODE_ENTRY_NAMES, entryNameTable.data(), &size), "readEnumChoices", "BFGTLNodeRead");
+    if (checkError(nodeRead(mNode, BFGTL_NODE_ENTRY_NAMES, entryNameTable.data(), &size), "readEnumChoices", "BFGTLNodeRead")) return false;
     const size_t *entryNameOffset = reinterpret_cast<size_t*>(entryNameTable.data());
     while (*entryNameOffset) {
         BFGTLNode hNode;
-        char *entryName = &entryNameTable[*entryNameOffset++];
-        checkError(BFGTLNodeOpen(mDev, entryName, &hNode), "readEnumChoices", "BFGTLNodeOpen");
-        BFGTLUtilU32 value;
-        size = sizeof(value);
-        checkError(BFGTLNodeRead(hNode, BFGTL_NODE_ACCESS, &value, &size), "readEnumChoices", "BFGTLNodeRead BFGTL_NDDE_ACCESS");
-        if ((value == BFGTL_ACCESS_RO) || (value == BFGTL_ACCESS_RW)) {
-            epicsInt64 entryValue;
-            size = sizeof(entryValue);
-            checkError(BFGTLNodeRead(hNode, BFGTL_NODE_VALUE, &entryValue, &size), "readEnumChoices", "BFGTLNodeRead BFGTL_NODE_VALUE");
-            char str[256];
-            size = sizeof(str);
-            checkError(BFGTLNodeRead(hNode, BFGTL_NODE_SYMBOLIC, str, &size), "readEnumChoices", "BFGTLNodeRead BFGTL_NODE_SYMBOLIC");
-            enumStrings.push_back(str);
-            enumValues.push_back((int)entryValue);
-        }      
+        BFNodeEntryInfo entry;
+        entry.name = &entryNameTable[*entryNameOffset++];
+        if (checkError(BFGTLNodeOpen(mDev, entry.name.c_str(), &hNode), "readEnumChoices", "BFGTLNodeOpen")) {
+            complete = false;
+            continue;
+        }
+        entry.value = 0;
+        size = sizeof(entry.value);
+        checkError(nodeRead(hNode, BFGTL_NODE_VALUE, &entry.value, &size), "readEnumChoices", "BFGTLNodeRead BFGTL_NODE_VALUE");
+        char str[256] = "";
+        size = sizeof(str);
+        checkError(nodeRead(hNode, BFGTL_NODE_SYMBOLIC, str, &size), "readEnumChoices", "BFGTLNodeRead BFGTL_NODE_SYMBOLIC");
+        entry.symbolic = str;
+        entries.push_back(entry);
+        handles.push_back(hNode);
+    }
+    return complete;
+}
+
+/** Reads the entry table of an enumeration, from the feature map if it has it, otherwise from the camera.
+  * The entries do not change, so this is done once.  The entry nodes are opened when their access
+  * mode is first needed and the handles are kept until the feature is destroyed.  A table with entries
+  * that could not be opened is used but not saved in the map, and is read again on the next access.
+  */
+void BFFeature::readEnumEntries() {
+    ADBitFlow *pDrv = (ADBitFlow *) mSet->getPortDriver();
+    BFFeatureMap *pMap = pDrv->getFeatureMap();
+    BFNodeInfo const *pInfo = pMap->find(mNodeName);
+    std::vector<BFNodeEntryInfo> entries;
+    std::vector<BFGTLNode> handles;
+    bool complete = true;
+    closeEnumEntries();
+    if (pInfo && pInfo->hasEntries) {
+        entries = pInfo->entries;
+    } else {
+        complete = readCameraEntries(entries, handles);
+        if (complete) pMap->updateEntries(mNodeName, entries);
+    }
+    setEnumEntries(entries, handles);
+    mEnumEntriesRead = complete;
+}
+
+void BFFeature::setEnumEntries(std::vector<BFNodeEntryInfo> const & entries, std::vector<BFGTLNode> const & handles) {
+    closeEnumEntries();
+    mEnumEntriesRead = true;
+    mEnumEntries.resize(entries.size());
+    for (size_t i=0; i<entries.size(); i++) {
+        mEnumEntries[i].name = entries[i].name;
+        mEnumEntries[i].hNode = handles.empty() ? 0 : handles[i];
+        mEnumEntries[i].value = entries[i].value;
+        mEnumEntries[i].symbolic = entries[i].symbolic;
+    }
+}
+
+void BFFeature::closeEnumEntries() {
+    for (size_t i=0; i<mEnumEntries.size(); i++) {
+        if (mEnumEntries[i].hNode) BFGTLNodeClose(mEnumEntries[i].hNode);
+    }
+    mEnumEntries.clear();
+    mEnumEntriesRead = false;
+}
+
+/** Returns the readable entries of an enumeration.
+  * The entry table is read once by readEnumEntries(), after that only the access mode of each entry
+  * is read, and only when the feature cache has been invalidated by a write or has expired.
+  */
+void BFFeature::readEnumChoices(std::vector<std::string>& enumStrings, std::vector<int>& enumValues) {
+    resolve();
+    if (!mEnumEntriesRead) readEnumEntries();
+    for (size_t i=0; i<mEnumEntries.size(); i++) {
+        BFEnumEntry & entry = mEnumEntries[i];
+        if (!mCache->lookup(entry.access)) {
+            BFGTLUtilU32 value = BFGTL_ACCESS_NA;
+            size_t size = sizeof(value);
+            if (!entry.hNode && checkError(BFGTLNodeOpen(mDev, entry.name.c_str(), &entry.hNode), "readEnumChoices", "BFGTLNodeOpen")) {
+                entry.hNode = 0;
+            } else if (!checkError(nodeRead(entry.hNode, BFGTL_NODE_ACCESS, &value, &size), "readEnumChoices", "BFGTLNodeRead BFGTL_NDDE_ACCESS")) {
+                mCache->store(entry.access, value);
+            }
+            entry.access.value = value;
+        }
+        if ((entry.access.value == BFGTL_ACCESS_RO) || (entry.access.value == BFGTL_ACCESS_RW)) {
+            enumStrings.push_back(entry.symbolic);
+            enumValues.push_back((int)entry.value);
+        }
+    }
+}
+
+void BFFeature::setPollClass(BFPollClass_t pollClass) {
+    mPollClass = pollClass;
+    mPolled = false;
+}
+
+BFPollClass_t BFFeature::getPollClass() {
+    return mPollClass;
+}
+
+/** Returns true if the polling thread should read this feature now and marks it as polled.
+  * Nodes that have not been opened yet are skipped, they are opened by the first access or by resolveFeaturesThread.
+  * Called with the driver lock held.
+  */
+bool BFFeature::pollDue(epicsTimeStamp const & now, double slowPeriod, double fastPeriod) {
+    bool due;
+    if (!mResolved) return false;
+    switch (mPollClass) {
+      case BFPollStatic:
+        due = !mPolled;
+        break;
+      case BFPollSlow:
+        due = !mPolled || (epicsTimeDiffInSeconds(&now, &mLastPoll) >= slowPeriod);
+        break;
+      case BFPollFast:
+        due = !mPolled || (epicsTimeDiffInSeconds(&now, &mLastPoll) >= fastPeriod);
+        break;
+      case BFPollOnChange:
+        due = !mPolled || (mPollGeneration != mCache->getGeneration());
+        break;
+      default:
+        due = false;
+        break;
+    }
+    if (!due) return false;
+    mPolled = true;
+    mLastPoll = now;
+    mPollGeneration = mCache->getGeneration();
+    // The access mode is cached, nodes that are not readable now are skipped until the next period
+    return isReadable();
+}
+
+/** Called by ADBitFlow::featureEvent when an event this feature is attached to occurs.  Called with the driver lock held. */
+void BFFeature::setEventPending() {
+    mEventPending = true;
+}
+
+/** Returns true if an event is pending for this feature and clears it.  Called with the driver lock held. */
+bool BFFeature::eventDue() {
+    if (!mEventPending || !mResolved) return false;
+    mEventPending = false;
+    return isReadable();
+}
+
+/** Reads the value of the node for the polling thread.
+  * This is called without the driver lock, GenTL producers are required to be thread safe and
+  * validate() does not close mNode while the call is in flight (see beginOffLock()).
+  */
+bool BFFeature::poll(BFFeatureValue & value) {
+    int err;
+    size_t size;
+    switch (mNodeType) {
+      case BFGTL_NODE_TYPE_INTEGER:
+      case BFGTL_NODE_TYPE_ENUMERATION: {
+        epicsInt64 iVal = 0;
+        size = sizeof(iVal);
+        err = nodeRead(mNode, BFGTL_NODE_VALUE, &iVal, &size);
+        value.intValue = iVal;
+        value.doubleValue = (double)iVal;
+        break;
+      }
+      case BFGTL_NODE_TYPE_BOOLEAN: {
+        BFGTLUtilBool bVal = 0;
+        size = sizeof(bVal);
+        err = nodeRead(mNode, BFGTL_NODE_VALUE, &bVal, &size);
+        value.intValue = bVal ? 1 : 0;
+        value.doubleValue = (double)value.intValue;
+        break;
+      }
+      case BFGTL_NODE_TYPE_FLOAT: {
+        double dVal = 0.;
+        size = sizeof(dVal);
+        err = nodeRead(mNode, BFGTL_NODE_VALUE, &dVal, &size);
+        value.intValue = (epicsInt64)dVal;
+        value.doubleValue = dVal;
+        break;
+      }
+      case BFGTL_NODE_TYPE_STRING: {
+        char str[256];
+        size = sizeof(str);
+        err = nodeRead(mNode, BFGTL_NODE_VALUE, str, &size);
+        str[sizeof(str)-1] = 0;
+        value.stringValue = str;
+        break;
+      }
+      default:
+        return false;
+    }
+    return (checkError(err, "poll", "BFGTLNodeRead") == asynSuccess);
+}
+
+/** Copies a value read by poll() to the parameter library.  Called with the driver lock held. */
+void BFFeature::deliver(BFFeatureValue const & value) {
+    asynPortDriver *pDrv = mSet->getPortDriver();
+    if (mAsynName.compare(0, 3, "GC_") != 0) {
+        // ADGenICam converts the units of the features it maps to ADDriver parameters, so these go through
+        // GenICamFeature::read() with the read functions returning the polled value
+        mPrefetch = value;
+        mPrefetched = true;
+        read(NULL, true);
+        mPrefetched = false;
+        return;
+    }
+    switch (mAsynType) {
+      case asynParamInt32:
+        pDrv->setIntegerParam(mAsynIndex, (epicsInt32)value.intValue);
+        break;
+      case asynParamInt64:
+        pDrv->setInteger64Param(mAsynIndex, value.intValue);
+        break;
+      case asynParamFloat64:
+        pDrv->setDoubleParam(mAsynIndex, value.doubleValue);
+        break;
+      case asynParamOctet:
+        pDrv->setStringParam(mAsynIndex, value.stringValue);
+        break;
+      default:
+        break;
+    }
+}
+
+/** Formats the value of a writable feature as a line of a configuration snapshot:
+  * <featureName> <type> <value>, where type is I (integer), F (float), B (boolean), E (enumeration,
+  * saved as the symbolic name) or S (string).  Returns false if the feature is not saved.
+  * Called with the driver lock held.
+  */
+bool BFFeature::snapshot(std::string & line) {
+    char buffer[512];
+    if (!isImplemented() || !isWritable()) return false;
+    const char *name = mNodeName.c_str();
+    switch (mNodeType) {
+      case BFGTL_NODE_TYPE_INTEGER:
+        epicsSnprintf(buffer, sizeof(buffer), "%s I %lld", name, (long long)readInteger());
+        break;
+      case BFGTL_NODE_TYPE_FLOAT:
+        epicsSnprintf(buffer, sizeof(buffer), "%s F %.17g", name, readDouble());
+        break;
+      case BFGTL_NODE_TYPE_BOOLEAN:
+        epicsSnprintf(buffer, sizeof(buffer), "%s B %d", name, readBoolean() ? 1 : 0);
+        break;
+      case BFGTL_NODE_TYPE_ENUMERATION:
+        epicsSnprintf(buffer, sizeof(buffer), "%s E %s", name, readEnumString().c_str());
+        break;
+      case BFGTL_NODE_TYPE_STRING:
+        epicsSnprintf(buffer, sizeof(buffer), "%s S %s", name, readString().c_str());
+        break;
+      default:
+        return false;
+    }
+    line = buffer;
+    return true;
+}
+
+/** Writes a value saved by snapshot() if it differs from the current value of the camera.
+  * The write is done immediately, bypassing the write queue, so that the caller sees whether it failed.
+  * Returns 0 if the value was unchanged, 1 if it was written and -1 on error.
+  * Called with the driver lock held.
+  */
+int BFFeature::restore(char type, std::string const & value) {
+    BFFeatureValue fValue;
+    BFWriteType_t writeType;
+    if (!isImplemented()) return -1;
+    switch (type) {
+      case 'I':
+        fValue.intValue = strtoll(value.c_str(), 0, 10);
+        if (readInteger() == fValue.intValue) return 0;
+        writeType = BFWriteInteger;
+        break;
+      case 'F':
+        fValue.doubleValue = strtod(value.c_str(), 0);
+        if (fabs(readDouble() - fValue.doubleValue) <= 1e-9*fabs(fValue.doubleValue)) return 0;
+        writeType = BFWriteDouble;
+        break;
+      case 'B':
+        fValue.intValue = atoi(value.c_str()) ? 1 : 0;
+        if ((readBoolean() ? 1 : 0) == fValue.intValue) return 0;
+        writeType = BFWriteBoolean;
+        break;
+      case 'E': {
+        // Enumerations are saved by name, the numeric values can differ between firmware versions
+        std::vector<std::string> enumStrings;
+        std::vector<int> enumValues;
+        size_t i;
+        readEnumChoices(enumStrings, enumValues);
+        for (i=0; i<enumStrings.size(); i++) {
+            if (enumStrings[i] == value) break;
+        }
+        if (i == enumStrings.size()) return -1;
+        fValue.intValue = enumValues[i];
+        if (readEnumIndex() == enumValues[i]) return 0;
+        writeType = BFWriteInteger;
+        break;
+      }
+      case 'S':
+        if (readString() == value) return 0;
+        fValue.stringValue = value;
+        writeType = BFWriteString;
+        break;
+      default:
+        return -1;
     }
+    asynStatus status = performWrite(writeType, fValue);
+    mCache->invalidate();
+    return (status == asynSuccess) ? 1 : -1;
 }
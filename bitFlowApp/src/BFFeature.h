@@ -1,9 +1,142 @@
 #ifndef BF_FEATURE_H
 #define BF_FEATURE_H
 
+#include <epicsTime.h>
+#include <epicsMutex.h>
 #include <GenICamFeature.h>
 
 #include "BFGTLUtilApi.h"
+#include "BFLatency.h"
+#include "BFFeatureMap.h"
+
+/** How often the background polling thread reads a feature */
+typedef enum {
+    BFPollAuto = -1,  // Chosen from the node type and access mode when the node is opened
+    BFPollNever,      // Only read when ADGenICam asks for it
+    BFPollStatic,     // Read once, e.g. DeviceModelName
+    BFPollSlow,       // Read every BFPollSlowPeriod
+    BFPollFast,       // Read every BFPollFastPeriod, e.g. DeviceTemperature
+    BFPollOnChange    // Read again after a write to any feature of the camera
+} BFPollClass_t;
+
+/** A feature value read by the polling thread or waiting to be written */
+struct BFFeatureValue {
+    epicsInt64 intValue;
+    double doubleValue;
+    std::string stringValue;
+};
+
+/** The data type a write passes to BFGTLNodeWrite */
+typedef enum {
+    BFWriteInteger,
+    BFWriteBoolean,
+    BFWriteDouble,
+    BFWriteString,
+    BFWriteCommand
+} BFWriteType_t;
+
+class BFFeature;
+
+/** A write queued for the driver's control thread */
+struct BFPendingWrite {
+    BFFeature *pFeature;
+    BFWriteType_t type;
+    BFFeatureValue value;
+    epicsTimeStamp queueTime;
+};
+
+/** A node attribute (access mode, limits) read from the camera and the time it was read */
+template <typename T>
+struct BFCachedValue {
+    BFCachedValue() : value(), valid(false), generation(0) {}
+    T value;
+    bool valid;
+    unsigned generation;
+    epicsTimeStamp time;
+};
+
+/** An entry of an enumeration node.  The value and symbolic name are read once and the handle is opened once,
+  * the access mode can change with the camera state and is kept in the feature cache. */
+struct BFEnumEntry {
+    std::string name;
+    BFGTLNode hNode;
+    epicsInt64 value;
+    std::string symbolic;
+    BFCachedValue<BFGTLUtilU32> access;
+};
+
+/** Validity of the cached node attributes of all the features of one camera.
+  * The BitFlow SDK does not expose the GenICam invalidator graph, so every feature write
+  * invalidates the attributes cached by all features of the camera.  Entries also expire after
+  * maxAge seconds so that changes the camera makes on its own are picked up.  maxAge=0 disables caching.
+  * Features are accessed with the driver lock held, so this class is not thread safe.
+  */
+class BFFeatureCache {
+public:
+    BFFeatureCache();
+    void invalidate();
+    void setMaxAge(double maxAge);
+    int getHits();
+    int getMisses();
+    unsigned getGeneration();
+    template <typename T> bool lookup(BFCachedValue<T> & entry) {
+        if (entry.valid && isCurrent(entry.generation, entry.time)) {
+            mHits++;
+            return true;
+        }
+        mMisses++;
+        return false;
+    }
+    template <typename T> void store(BFCachedValue<T> & entry, T value) {
+        entry.value = value;
+        entry.valid = true;
+        entry.generation = mGeneration;
+        epicsTimeGetCurrent(&entry.time);
+    }
+
+private:
+    bool isCurrent(unsigned generation, epicsTimeStamp const & time);
+    unsigned mGeneration;
+    double mMaxAge;
+    int mHits;
+    int mMisses;
+};
+
+/** Control channel transactions (BFGTLNodeRead/BFGTLNodeWrite calls) made by one feature */
+struct BFNodeStats {
+    BFNodeStats() : reads(0), writes(0), readTime(0.), writeTime(0.), maxTime(0.) {}
+    int reads;
+    int writes;
+    double readTime;
+    double writeTime;
+    double maxTime;
+};
+
+/** Counts and times the control channel transactions of all the features of one camera.
+  * Features read and write their nodes from the polling and control threads without the driver lock,
+  * so the statistics, including the BFNodeStats of each feature, are protected by a mutex of their own.
+  */
+class BFControlStats {
+public:
+    BFControlStats();
+    void add(BFNodeStats & node, bool isWrite, double seconds);
+    void reset();
+    void lock();
+    void unlock();
+    int getReads();
+    int getWrites();
+    double getTime();
+    void getReadPercentiles(double *p50, double *p99, double *max);
+    void getWritePercentiles(double *p50, double *p99, double *max);
+
+private:
+    epicsMutex mMutex;
+    int mReads;
+    int mWrites;
+    double mTime;
+    BFLatencyStats mReadLatency;
+    BFLatencyStats mWriteLatency;
+};
 
 class BFFeature : public GenICamFeature
 {
@@ -11,6 +144,7 @@ public:
     BFFeature(GenICamFeatureSet *set, 
               std::string const & asynName, asynParamType asynType, int asynIndex,
               std::string const & featureName, GCFeatureType_t featureType);
+    virtual ~BFFeature();
     virtual bool isImplemented(void);
     virtual bool isAvailable(void);
     virtual bool isReadable(void);
@@ -34,15 +168,80 @@ public:
     virtual std::string readString(void);
     virtual void writeString(std::string const & value);
     virtual void writeCommand(void);
+    void resolve(void);
+    bool validate(void);
+    void setPollClass(BFPollClass_t pollClass);
+    BFPollClass_t getPollClass(void);
+    bool pollDue(epicsTimeStamp const & now, double slowPeriod, double fastPeriod);
+    void setEventPending(void);
+    bool eventDue(void);
+    bool poll(BFFeatureValue & value);
+    void deliver(BFFeatureValue const & value);
+    asynStatus performWrite(BFWriteType_t type, BFFeatureValue const & value);
+    bool snapshot(std::string & line);
+    int restore(char type, std::string const & value);
+    BFNodeStats & getNodeStats(void);
+    void beginOffLock(void);
+    void endOffLock(void);
 
 private:
     inline asynStatus checkError(int error, const char *functionName, const char *BFFunction);
+    int nodeRead(BFGTLNode hNode, BFGTLNodeInfo info, void *pValue, size_t *pSize);
+    int nodeWrite(BFGTLNode hNode, BFGTLNodeInfo info, const void *pValue, size_t size);
+    template <typename T> T readCached(BFCachedValue<T> & entry, BFGTLNodeInfo info, const char *functionName);
+    BFGTLUtilU32 readAccess(const char *functionName);
+    void write(BFWriteType_t type, BFFeatureValue const & value);
+    void readEnumEntries(void);
+    bool readCameraEntries(std::vector<BFNodeEntryInfo> & entries, std::vector<BFGTLNode> & handles);
+    void setEnumEntries(std::vector<BFNodeEntryInfo> const & entries, std::vector<BFGTLNode> const & handles);
+    void closeEnumEntries(void);
+    void retireNode(void);
+    void openNode(const char *functionName);
+    BFGTLNodeType readNodeType(const char *functionName);
+    void bindAccessors(void);
+    double readFloat(void);
+    double readFloatMin(void);
+    double readFloatMax(void);
+    void writeFloat(double value);
+    double readIntegerAsDouble(void);
+    double readIntegerMinAsDouble(void);
+    double readIntegerMaxAsDouble(void);
+    void writeDoubleAsInteger(double value);
     asynUser *mAsynUser;
     BFGTLDev mDev;
     BFGTLNode mNode;
     BFGTLNodeType mNodeType;
     std::string mNodeName;
     bool mIsImplemented;
+    bool mResolved;
+    BFPollClass_t mPollClass;
+    bool mPolled;
+    unsigned mPollGeneration;
+    epicsTimeStamp mLastPoll;
+    bool mEventPending;
+    BFFeatureCache *mCache;
+    BFControlStats *mControlStats;
+    BFNodeStats mNodeStats;
+    BFCachedValue<BFGTLUtilU32> mAccess;
+    BFCachedValue<epicsInt64> mIntegerMin;
+    BFCachedValue<epicsInt64> mIntegerMax;
+    BFCachedValue<epicsInt64> mIncrement;
+    BFCachedValue<double> mDoubleMin;
+    BFCachedValue<double> mDoubleMax;
+    std::vector<BFEnumEntry> mEnumEntries;
+    bool mEnumEntriesRead;
+    bool mFromMap;
+    /* poll() and performWrite() calls in flight without the lock, and a handle closed by validate() while they were */
+    int mOffLockCalls;
+    BFGTLNode mRetiredNode;
+    /* Set by deliver() while GenICamFeature::read() runs, the read functions then return mPrefetch */
+    bool mPrefetched;
+    BFFeatureValue mPrefetch;
+    /* Bound by bindAccessors() from the node type */
+    double (BFFeature::*mReadDouble)(void);
+    double (BFFeature::*mReadDoubleMin)(void);
+    double (BFFeature::*mReadDoubleMax)(void);
+    void (BFFeature::*mWriteDouble)(double value);
 
 };
 
@@ -0,0 +1,153 @@
+// BFFeatureMap.cpp
+// GenICam node metadata saved to disk so the node map does not have to be rediscovered at every IOC start.
+//
+// The file is text with one line per node followed by one line per enumeration entry:
+//   key <model>|<firmware>|<SDK version>
+//   node <name> <exists> <type> <access> <hasEntries>
+//   entry <name> <value> <symbolic>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "BFFeatureMap.h"
+
+BFFeatureMap::BFFeatureMap()
+    : mEnabled(false), mDirty(false)
+{
+}
+
+/** Enables the map and reads it from a file.
+  * \param[in] fileName The file to read, and to write with save()
+  * \param[in] key Identifies the camera model, firmware and SDK version.  A file with a different key is ignored.
+  * Returns the number of nodes read, 0 if the file does not exist or does not match the key, in which
+  * case the map starts empty and is filled as nodes are discovered.
+  */
+int BFFeatureMap::load(std::string const & fileName, std::string const & key)
+{
+    char line[1024];
+    char name[256], symbolic[256];
+    int exists, type, hasEntries;
+    unsigned access;
+    long long value;
+    BFNodeInfo *pNode = 0;
+
+    mFileName = fileName;
+    mKey = key;
+    mEnabled = true;
+    mDirty = false;
+    mNodes.clear();
+    FILE *fp = fopen(fileName.c_str(), "r");
+    if (!fp) return 0;
+    if (!fgets(line, sizeof(line), fp) || (strncmp(line, "key ", 4) != 0) ||
+        (std::string(line+4, strcspn(line+4, "\r\n")) != key)) {
+        fclose(fp);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "node %255s %d %d %u %d", name, &exists, &type, &access, &hasEntries) == 5) {
+            pNode = &mNodes[name];
+            pNode->exists = (exists != 0);
+            pNode->type = type;
+            pNode->access = access;
+            pNode->hasEntries = (hasEntries != 0);
+            pNode->entries.clear();
+        } else if (pNode && (sscanf(line, "entry %255s %lld %255s", name, &value, symbolic) == 3)) {
+            BFNodeEntryInfo entry;
+            entry.name = name;
+            entry.value = value;
+            entry.symbolic = symbolic;
+            pNode->entries.push_back(entry);
+        }
+    }
+    fclose(fp);
+    return (int)mNodes.size();
+}
+
+/** Writes the map to the file given to load().  Returns 0 on success. */
+int BFFeatureMap::save()
+{
+    if (!mEnabled) return -1;
+    std::string tempName = mFileName + ".tmp";
+    FILE *fp = fopen(tempName.c_str(), "w");
+    if (!fp) return -1;
+    fprintf(fp, "key %s\n", mKey.c_str());
+    std::map<std::string, BFNodeInfo>::iterator it;
+    for (it = mNodes.begin(); it != mNodes.end(); ++it) {
+        BFNodeInfo & node = it->second;
+        fprintf(fp, "node %s %d %d %u %d\n", it->first.c_str(), node.exists, node.type, node.access, node.hasEntries);
+        for (size_t i=0; i<node.entries.size(); i++) {
+            fprintf(fp, "entry %s %lld %s\n", node.entries[i].name.c_str(),
+                    (long long)node.entries[i].value, node.entries[i].symbolic.c_str());
+        }
+    }
+    if (fclose(fp) != 0) return -1;
+    // Replace the old file only once the new one is complete, so a crash cannot leave a truncated map
+    remove(mFileName.c_str());
+    if (rename(tempName.c_str(), mFileName.c_str()) != 0) return -1;
+    mDirty = false;
+    return 0;
+}
+
+bool BFFeatureMap::isEnabled()
+{
+    return mEnabled;
+}
+
+bool BFFeatureMap::isDirty()
+{
+    return mDirty;
+}
+
+int BFFeatureMap::getNumNodes()
+{
+    return (int)mNodes.size();
+}
+
+std::string const & BFFeatureMap::getFileName()
+{
+    return mFileName;
+}
+
+/** Returns the saved information about a node, or NULL if the map is disabled or does not contain the node */
+BFNodeInfo const *BFFeatureMap::find(std::string const & nodeName)
+{
+    if (!mEnabled) return 0;
+    std::map<std::string, BFNodeInfo>::iterator it = mNodes.find(nodeName);
+    if (it == mNodes.end()) return 0;
+    return &it->second;
+}
+
+/** Records the existence, type and access mode of a node, keeping any saved enumeration entries */
+void BFFeatureMap::update(std::string const & nodeName, BFNodeInfo const & info)
+{
+    if (!mEnabled) return;
+    std::map<std::string, BFNodeInfo>::iterator it = mNodes.find(nodeName);
+    if ((it != mNodes.end()) && (it->second.exists == info.exists) &&
+        (it->second.type == info.type) && (it->second.access == info.access)) return;
+    BFNodeInfo & node = mNodes[nodeName];
+    node.exists = info.exists;
+    node.type = info.type;
+    node.access = info.access;
+    mDirty = true;
+}
+
+/** Records the entries of an enumeration node */
+void BFFeatureMap::updateEntries(std::string const & nodeName, std::vector<BFNodeEntryInfo> const & entries)
+{
+    if (!mEnabled) return;
+    BFNodeInfo & node = mNodes[nodeName];
+    node.hasEntries = true;
+    node.entries = entries;
+    mDirty = true;
+}
+
+/** Forgets the enumeration entries of a node, they are read from the camera on the next access */
+void BFFeatureMap::eraseEntries(std::string const & nodeName)
+{
+    if (!mEnabled) return;
+    std::map<std::string, BFNodeInfo>::iterator it = mNodes.find(nodeName);
+    if ((it == mNodes.end()) || !it->second.hasEntries) return;
+    it->second.hasEntries = false;
+    it->second.entries.clear();
+    mDirty = true;
+}
@@ -0,0 +1,56 @@
+// BFFeatureMap.h
+// GenICam node metadata saved to disk so the node map does not have to be rediscovered at every IOC start.
+
+#ifndef BF_FEATURE_MAP_H
+#define BF_FEATURE_MAP_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+
+/** An enumeration entry as saved in the map */
+struct BFNodeEntryInfo {
+    std::string name;
+    epicsInt64 value;
+    std::string symbolic;
+};
+
+/** What is known about one node.  access is the access mode when the node was discovered. */
+struct BFNodeInfo {
+    BFNodeInfo() : exists(false), type(0), access(0), hasEntries(false) {}
+    bool exists;
+    int type;
+    unsigned access;
+    bool hasEntries;
+    std::vector<BFNodeEntryInfo> entries;
+};
+
+/** The node metadata of one camera model, firmware and SDK version.
+  * The map is disabled until load() is called, find() then returns NULL and update() does nothing.
+  * This class is not thread safe, the driver calls it with its lock held.
+  */
+class BFFeatureMap {
+public:
+    BFFeatureMap();
+    int load(std::string const & fileName, std::string const & key);
+    int save();
+    bool isEnabled();
+    bool isDirty();
+    int getNumNodes();
+    std::string const & getFileName();
+    BFNodeInfo const *find(std::string const & nodeName);
+    void update(std::string const & nodeName, BFNodeInfo const & info);
+    void updateEntries(std::string const & nodeName, std::vector<BFNodeEntryInfo> const & entries);
+    void eraseEntries(std::string const & nodeName);
+
+private:
+    std::map<std::string, BFNodeInfo> mNodes;
+    std::string mFileName;
+    std::string mKey;
+    bool mEnabled;
+    bool mDirty;
+};
+
+#endif
@@ -0,0 +1,59 @@
+// BFLatency.cpp
+// Percentile statistics of the latencies measured by the driver.
+
+#include <algorithm>
+
+#include "BFLatency.h"
+
+/** Constructor for the BFLatencyStats class
+  * \param[in] numSamples Number of most recent samples the percentiles are computed over.
+  */
+BFLatencyStats::BFLatencyStats(int numSamples)
+{
+    if (numSamples < 1) numSamples = 1;
+    mSamples.resize(numSamples);
+    mWork.reserve(numSamples);
+    reset();
+}
+
+/** Discards all samples */
+void BFLatencyStats::reset()
+{
+    mNumSamples = 0;
+    mNext = 0;
+}
+
+/** Adds a sample, replacing the oldest one once the ring is full */
+void BFLatencyStats::add(double value)
+{
+    mSamples[mNext] = value;
+    mNext = (mNext + 1) % mSamples.size();
+    if (mNumSamples < mSamples.size()) mNumSamples++;
+}
+
+int BFLatencyStats::getNumSamples()
+{
+    return (int)mNumSamples;
+}
+
+/** Computes the median, 99th percentile and maximum of the samples, all 0 if there are none */
+void BFLatencyStats::getPercentiles(double *p50, double *p99, double *max)
+{
+    *p50 = *p99 = *max = 0.;
+    if (mNumSamples == 0) return;
+    mWork.assign(mSamples.begin(), mSamples.begin() + mNumSamples);
+    std::vector<double>::iterator i50 = mWork.begin() + (mNumSamples-1)/2;
+    std::vector<double>::iterator i99 = mWork.begin() + (mNumSamples-1)*99/100;
+    std::nth_element(mWork.begin(), i99, mWork.end());
+    *p99 = *i99;
+    *max = *std::max_element(i99, mWork.end());
+    std::nth_element(mWork.begin(), i50, i99);
+    *p50 = *i50;
+}
+
+/** Returns the smallest of the samples, 0 if there are none */
+double BFLatencyStats::getMin()
+{
+    if (mNumSamples == 0) return 0.;
+    return *std::min_element(mSamples.begin(), mSamples.begin() + mNumSamples);
+}
@@ -0,0 +1,31 @@
+// BFLatency.h
+// Percentile statistics of the latencies measured by the driver.
+
+#ifndef BF_LATENCY_H
+#define BF_LATENCY_H
+
+#include <stddef.h>
+
+#include <vector>
+
+/** Keeps the most recent latency samples in a ring and computes percentiles over them.
+  * Adding a sample is O(1), the percentiles are computed on demand by the status thread.
+  * This class is not thread safe, the caller must serialize access.
+  */
+class BFLatencyStats {
+public:
+    BFLatencyStats(int numSamples);
+    void reset();
+    void add(double value);
+    int getNumSamples();
+    void getPercentiles(double *p50, double *p99, double *max);
+    double getMin();
+
+private:
+    std::vector<double> mSamples;
+    std::vector<double> mWork;        // Scratch copy reordered by nth_element
+    size_t mNumSamples;
+    size_t mNext;
+};
+
+#endif
@@ -0,0 +1,100 @@
+// BFPreview.cpp
+// asyn port that publishes a reduced-rate, reduced-size preview of the frames.
+
+#include <epicsTypes.h>
+#include <asynDriver.h>
+
+#include "BFPreview.h"
+
+static const char *driverName = "BFPreview";
+
+/** Averages binning x binning blocks of the frame and shifts the result right by shift bits */
+template <typename epicsTypeIn, typename epicsTypeOut>
+static void binFrame(const epicsTypeIn *pIn, epicsTypeOut *pOut, size_t nCols, size_t nRows, int binning, int shift)
+{
+    size_t outCols = nCols/binning;
+    size_t outRows = nRows/binning;
+    epicsUInt32 numSummed = binning*binning;
+
+    for (size_t row=0; row<outRows; row++) {
+        for (size_t col=0; col<outCols; col++) {
+            epicsUInt32 sum = 0;
+            for (int i=0; i<binning; i++) {
+                const epicsTypeIn *pBlock = pIn + (row*binning + i)*nCols + col*binning;
+                for (int j=0; j<binning; j++) {
+                    sum += pBlock[j];
+                }
+            }
+            *pOut++ = (epicsTypeOut)((sum/numSummed) >> shift);
+        }
+    }
+}
+
+/** Constructor for the BFPreview class
+  * \param[in] portName asyn port name for the preview.
+  * \param[in] maxMemory Maximum memory (in bytes) of the preview NDArrays.  A preview that does not fit is dropped.
+  */
+BFPreview::BFPreview(const char *portName, size_t maxMemory)
+    : asynNDArrayDriver(portName, 1, 0, maxMemory,
+                        asynInt32Mask | asynFloat64Mask | asynOctetMask | asynGenericPointerMask | asynDrvUserMask,
+                        asynInt32Mask | asynFloat64Mask | asynOctetMask | asynGenericPointerMask,
+                        0, 1, 0, 0)
+{
+    setIntegerParam(NDArrayCallbacks, 1);
+}
+
+/** Publishes a preview of one frame.
+  * \param[in] pData The frame, 1 or 2 bytes per pixel, monochrome.
+  * \param[in] nCols Width of the frame.
+  * \param[in] nRows Height of the frame.
+  * \param[in] pixelSize Bytes per pixel of the frame.
+  * \param[in] binning The preview is binning times smaller in each direction.
+  * \param[in] shift If >=0 the pixels are shifted right by this many bits and the preview is 8 bit.
+  *            If <0 the preview has the data type of the frame.
+  * \param[in] uniqueId, timeStamp, epicsTS Copied to the preview NDArray.
+  */
+asynStatus BFPreview::publish(const void *pData, size_t nCols, size_t nRows, int pixelSize,
+                              int binning, int shift, int uniqueId, double timeStamp, epicsTimeStamp const & epicsTS)
+{
+    static const char *functionName = "publish";
+    size_t dims[2];
+    NDDataType_t dataType;
+    NDArray *pArray;
+    int arrayCounter;
+
+    if (binning < 1) binning = 1;
+    dims[0] = nCols/binning;
+    dims[1] = nRows/binning;
+    if ((dims[0] == 0) || (dims[1] == 0) || ((pixelSize != 1) && (pixelSize != 2))) return asynError;
+    dataType = ((shift >= 0) || (pixelSize == 1)) ? NDUInt8 : NDUInt16;
+    if (shift < 0) shift = 0;
+    pArray = pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
+    if (!pArray) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error allocating preview array\n",
+            driverName, functionName);
+        return asynError;
+    }
+    if (pixelSize == 1) {
+        binFrame((const epicsUInt8 *)pData, (epicsUInt8 *)pArray->pData, nCols, nRows, binning, shift);
+    } else if (dataType == NDUInt8) {
+        binFrame((const epicsUInt16 *)pData, (epicsUInt8 *)pArray->pData, nCols, nRows, binning, shift);
+    } else {
+        binFrame((const epicsUInt16 *)pData, (epicsUInt16 *)pArray->pData, nCols, nRows, binning, shift);
+    }
+    pArray->uniqueId = uniqueId;
+    pArray->timeStamp = timeStamp;
+    pArray->epicsTS = epicsTS;
+
+    lock();
+    getIntegerParam(NDArrayCounter, &arrayCounter);
+    setIntegerParam(NDArrayCounter, arrayCounter+1);
+    setIntegerParam(NDArraySizeX, (int)dims[0]);
+    setIntegerParam(NDArraySizeY, (int)dims[1]);
+    setIntegerParam(NDDataType, dataType);
+    doCallbacksGenericPointer(pArray, NDArrayData, 0);
+    callParamCallbacks();
+    unlock();
+    pArray->release();
+    return asynSuccess;
+}
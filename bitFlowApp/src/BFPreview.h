@@ -0,0 +1,24 @@
+// BFPreview.h
+// asyn port that publishes a reduced-rate, reduced-size preview of the frames.
+
+#ifndef BF_PREVIEW_H
+#define BF_PREVIEW_H
+
+#include <stddef.h>
+
+#include <epicsTime.h>
+#include <asynNDArrayDriver.h>
+
+/** NDArray source for displays.  ADGenICam drivers have a single address, so the preview is published
+  * on its own port.  Plugins connect to it with NDArrayPort=<driver port>_PREVIEW.
+  * The preview NDArrays come from this port's own pool, so they do not use memory of the driver's pool.
+  * That pool is bounded by maxMemory, which the driver counts against BFMemoryBudget.
+  */
+class BFPreview : public asynNDArrayDriver {
+public:
+    BFPreview(const char *portName, size_t maxMemory);
+    asynStatus publish(const void *pData, size_t nCols, size_t nRows, int pixelSize,
+                       int binning, int shift, int uniqueId, double timeStamp, epicsTimeStamp const & epicsTS);
+};
+
+#endif
@@ -0,0 +1,327 @@
+// BFSystem.cpp
+// Operating system support for placing the acquisition threads.
+
+#ifndef _WIN32
+  #ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+  #endif
+  #include <pthread.h>
+  #include <sched.h>
+  #include <dirent.h>
+  #include <unistd.h>
+  #include <sys/syscall.h>
+  #include <sys/mman.h>
+#else
+  #include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include <algorithm>
+
+#include "BFSystem.h"
+
+/** Parses a list of CPU numbers such as "2", "4-7" or "0,2,8-11".
+  * \param[in] cpuList The list.  NULL or an empty string produces an empty vector.
+  * \param[out] cpus The CPU numbers in the order they appear in the list.
+  * \return 0 on success, -1 if the list could not be parsed.
+  */
+int parseCPUList(const char *cpuList, std::vector<int> &cpus)
+{
+    cpus.clear();
+    if (!cpuList) return 0;
+    const char *p = cpuList;
+    while (*p) {
+        char *end;
+        if ((*p == ',') || (*p == ' ')) {
+            p++;
+            continue;
+        }
+        long first = strtol(p, &end, 10);
+        if ((end == p) || (first < 0)) return -1;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if ((end == p) || (last < first)) return -1;
+            p = end;
+        }
+        for (long cpu=first; cpu<=last; cpu++) {
+            cpus.push_back((int)cpu);
+        }
+    }
+    return 0;
+}
+
+/** Formats a vector of CPU numbers as a comma separated list */
+std::string formatCPUList(const std::vector<int> &cpus)
+{
+    std::string list;
+    char temp[16];
+    for (size_t i=0; i<cpus.size(); i++) {
+        sprintf(temp, "%s%d", (i == 0) ? "" : ",", cpus[i]);
+        list += temp;
+    }
+    return list;
+}
+
+/** Restricts the calling thread to a set of CPUs.
+  * \param[in] cpus The CPU numbers.  If empty the affinity is not changed.
+  * \return 0 on success, otherwise the error from the operating system.
+  */
+int setThreadAffinity(const std::vector<int> &cpus)
+{
+    if (cpus.empty()) return 0;
+#ifdef _WIN32
+    DWORD_PTR mask = 0;
+    for (size_t i=0; i<cpus.size(); i++) {
+        if (cpus[i] < (int)(8*sizeof(mask))) mask |= ((DWORD_PTR)1 << cpus[i]);
+    }
+    if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) return (int)GetLastError();
+    return 0;
+#else
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (size_t i=0; i<cpus.size(); i++) {
+        if (cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &cpuSet);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
+
+/** Switches the calling thread to real-time scheduling.
+  * On Linux this is SCHED_FIFO with the given priority (1-99), which requires CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+  * On Windows the thread priority is set to THREAD_PRIORITY_TIME_CRITICAL.
+  * \param[in] priority The priority.  If <= 0 the scheduling is not changed.
+  * \return 0 on success, otherwise the error from the operating system.
+  */
+int setThreadRealTimePriority(int priority)
+{
+    if (priority <= 0) return 0;
+#ifdef _WIN32
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) return (int)GetLastError();
+    return 0;
+#else
+    struct sched_param param;
+    int maxPriority = sched_get_priority_max(SCHED_FIFO);
+    param.sched_priority = (priority > maxPriority) ? maxPriority : priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+#ifndef _WIN32
+static int readSysfsFile(std::string const & fileName, char *buffer, size_t size)
+{
+    FILE *fp = fopen(fileName.c_str(), "r");
+    if (!fp) return -1;
+    char *p = fgets(buffer, (int)size, fp);
+    fclose(fp);
+    if (!p) return -1;
+    buffer[strcspn(buffer, "\n")] = 0;
+    return 0;
+}
+#endif
+
+/** Finds the NUMA node of a BitFlow board from the PCI devices in sysfs.
+  * The boards are the PCI devices bound to a kernel driver whose name contains "bitflow",
+  * numbered in order of PCI address.
+  * \param[in] boardNum The board number.
+  * \param[out] pciAddress The PCI address of the board.
+  * \param[out] node The NUMA node of the board, -1 if the system is not NUMA.
+  * \param[out] cpus The CPUs local to the board.
+  * \return 0 on success, -1 if the board was not found or this is not supported on this OS.
+  */
+int findBoardNUMANode(int boardNum, std::string &pciAddress, int *node, std::vector<int> &cpus)
+{
+    *node = -1;
+    cpus.clear();
+#ifdef _WIN32
+    return -1;
+#else
+    static const char *pciDir = "/sys/bus/pci/devices";
+    std::vector<std::string> boards;
+    char link[256];
+    char buffer[1024];
+
+    DIR *pDir = opendir(pciDir);
+    if (!pDir) return -1;
+    struct dirent *pEntry;
+    while ((pEntry = readdir(pDir)) != NULL) {
+        if (pEntry->d_name[0] == '.') continue;
+        std::string driverLink = std::string(pciDir) + "/" + pEntry->d_name + "/driver";
+        ssize_t len = readlink(driverLink.c_str(), link, sizeof(link)-1);
+        if (len <= 0) continue;
+        link[len] = 0;
+        const char *driverName = strrchr(link, '/');
+        driverName = driverName ? driverName+1 : link;
+        std::string lowerName(driverName);
+        std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+        if (lowerName.find("bitflow") != std::string::npos) boards.push_back(pEntry->d_name);
+    }
+    closedir(pDir);
+    std::sort(boards.begin(), boards.end());
+    if ((boardNum < 0) || (boardNum >= (int)boards.size())) return -1;
+    pciAddress = boards[boardNum];
+    std::string deviceDir = std::string(pciDir) + "/" + pciAddress;
+    if (readSysfsFile(deviceDir + "/numa_node", buffer, sizeof(buffer)) == 0) {
+        *node = atoi(buffer);
+    }
+    if (readSysfsFile(deviceDir + "/local_cpulist", buffer, sizeof(buffer)) == 0) {
+        parseCPUList(buffer, cpus);
+    }
+    return 0;
+#endif
+}
+
+/** Sets the memory policy of the calling thread to prefer a NUMA node.
+  * Pages the thread touches first, for example when it copies into a newly allocated NDArray,
+  * are then allocated on that node.  libnuma is not required, the system call is used directly.
+  * \param[in] node The NUMA node.  If < 0 the policy is not changed.
+  * \return 0 on success, otherwise errno.
+  */
+int setThreadMemoryNode(int node)
+{
+    if (node < 0) return 0;
+#if defined(_WIN32) || !defined(SYS_set_mempolicy)
+    return -1;
+#else
+    static const int MPOL_PREFERRED_MODE = 1;
+    unsigned long nodeMask[16];
+    int bitsPerLong = 8*sizeof(unsigned long);
+    if (node >= 16*bitsPerLong) return -1;
+    memset(nodeMask, 0, sizeof(nodeMask));
+    nodeMask[node/bitsPerLong] = 1UL << (node % bitsPerLong);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, nodeMask, (unsigned long)(16*bitsPerLong))) return errno;
+    return 0;
+#endif
+}
+
+static size_t getPageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/** Places a buffer on a NUMA node, whichever thread touches it first.
+  * Pages that are already allocated on another node are moved.  Only the whole pages of the buffer
+  * are bound, the partial pages at the ends keep the policy of the thread that touches them.
+  * \param[in] node The NUMA node.  If < 0 the policy is not changed.
+  * \return 0 on success, -1 if not supported, otherwise errno.
+  */
+int bindMemoryNode(void *pData, size_t size, int node)
+{
+    if (node < 0) return 0;
+#if defined(_WIN32) || !defined(SYS_mbind)
+    return -1;
+#else
+    static const int MPOL_PREFERRED_MODE = 1;
+    static const unsigned int MPOL_MF_MOVE_FLAG = 1 << 1;
+    unsigned long nodeMask[16];
+    int bitsPerLong = 8*sizeof(unsigned long);
+    size_t pageSize = getPageSize();
+    char *start = (char *)(((size_t)pData + pageSize - 1) & ~(pageSize - 1));
+    char *end = (char *)(((size_t)pData + size) & ~(pageSize - 1));
+    if (node >= 16*bitsPerLong) return -1;
+    if (end <= start) return 0;
+    memset(nodeMask, 0, sizeof(nodeMask));
+    nodeMask[node/bitsPerLong] = 1UL << (node % bitsPerLong);
+    if (syscall(SYS_mbind, start, (unsigned long)(end - start), MPOL_PREFERRED_MODE, nodeMask,
+                (unsigned long)(16*bitsPerLong), MPOL_MF_MOVE_FLAG)) return errno;
+    return 0;
+#endif
+}
+
+/** Asks the kernel to back a buffer with transparent huge pages (2 MiB on x86_64).
+  * This must be done before the pages are first touched.  Only the 2 MiB aligned parts of the buffer
+  * can use huge pages.
+  * \return 0 on success, -1 if not supported, otherwise errno.
+  */
+int adviseHugePages(void *pData, size_t size)
+{
+#if defined(_WIN32) || !defined(MADV_HUGEPAGE)
+    return -1;
+#else
+    size_t pageSize = getPageSize();
+    char *start = (char *)(((size_t)pData + pageSize - 1) & ~(pageSize - 1));
+    char *end = (char *)(((size_t)pData + size) & ~(pageSize - 1));
+    if (end <= start) return 0;
+    if (madvise(start, end - start, MADV_HUGEPAGE)) return errno;
+    return 0;
+#endif
+}
+
+/** Locks a buffer in physical memory so it cannot be paged out.
+  * On Linux this is limited by RLIMIT_MEMLOCK unless the process has CAP_IPC_LOCK.
+  * \return 0 on success, otherwise the error from the operating system.
+  */
+int lockMemory(void *pData, size_t size)
+{
+#ifdef _WIN32
+    if (!VirtualLock(pData, size)) return (int)GetLastError();
+    return 0;
+#else
+    if (mlock(pData, size)) return errno;
+    return 0;
+#endif
+}
+
+/** Unlocks a buffer locked with lockMemory().  This must be done before the buffer is freed, because
+  * a heap page that is reused keeps its lock and still counts against RLIMIT_MEMLOCK.
+  * \return 0 on success, otherwise the error from the operating system.
+  */
+int unlockMemory(void *pData, size_t size)
+{
+#ifdef _WIN32
+    if (!VirtualUnlock(pData, size)) return (int)GetLastError();
+    return 0;
+#else
+    if (munlock(pData, size)) return errno;
+    return 0;
+#endif
+}
+
+/** Writes one byte in every page of a buffer so that all of its pages are faulted in now rather
+  * than during the first copy into it.
+  */
+void touchMemory(void *pData, size_t size)
+{
+    size_t pageSize = getPageSize();
+    volatile char *p = (volatile char *)pData;
+    for (size_t i=0; i<size; i+=pageSize) {
+        p[i] = 0;
+    }
+    if (size > 0) p[size-1] = 0;
+}
+
+/** Returns the amount of anonymous memory in this process that is backed by huge pages, in MB.
+  * Returns -1 if this is not available.
+  */
+double getHugePageMemory()
+{
+#ifdef _WIN32
+    return -1.;
+#else
+    char line[256];
+    double sizeKB = -1.;
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    if (!fp) return -1.;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "AnonHugePages:", 14) == 0) {
+            sizeKB = atof(line + 14);
+            break;
+        }
+    }
+    fclose(fp);
+    return (sizeKB < 0) ? -1. : sizeKB/1024.;
+#endif
+}
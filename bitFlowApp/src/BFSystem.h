@@ -0,0 +1,26 @@
+// BFSystem.h
+// Operating system support for placing the acquisition threads.
+// These are not provided by libCom, so they are implemented here for Linux and Windows.
+
+#ifndef BF_SYSTEM_H
+#define BF_SYSTEM_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+int parseCPUList(const char *cpuList, std::vector<int> &cpus);
+std::string formatCPUList(const std::vector<int> &cpus);
+int setThreadAffinity(const std::vector<int> &cpus);
+int setThreadRealTimePriority(int priority);
+int findBoardNUMANode(int boardNum, std::string &pciAddress, int *node, std::vector<int> &cpus);
+int setThreadMemoryNode(int node);
+int bindMemoryNode(void *pData, size_t size, int node);
+int adviseHugePages(void *pData, size_t size);
+int lockMemory(void *pData, size_t size);
+int unlockMemory(void *pData, size_t size);
+void touchMemory(void *pData, size_t size);
+double getHugePageMemory();
+
+#endif
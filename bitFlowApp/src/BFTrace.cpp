@@ -0,0 +1,192 @@
+// BFTrace.cpp
+// Per-frame trace recorder for the acquisition path.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <epicsAtomic.h>
+#include <epicsGuard.h>
+#include <cantProceed.h>
+
+#include "BFTrace.h"
+
+static const char *eventNames[BFTraceNumEvents] = {
+    "wait for frame",
+    "got frame",
+    "hold buffer",
+    "send message",
+    "dequeue",
+    "lock",
+    "frame info",
+    "alloc",
+    "copy",
+    "attributes",
+    "release buffer",
+    "callbacks",
+    "stop capture"
+};
+
+static const char *eventName(int event)
+{
+    return ((event >= 0) && (event < BFTraceNumEvents)) ? eventNames[event] : "unknown";
+}
+
+/** Constructor for the BFTraceRing class
+  * \param[in] numRecords The number of records in the ring.  Rounded up to a power of 2.
+  * \param[in] index Index of this ring, used as the thread ID in the Chrome trace.
+  */
+BFTraceRing::BFTraceRing(size_t numRecords, int index)
+    : threadIndex(index), mHead(0)
+{
+    size_t size = 1;
+    while (size < numRecords) size <<= 1;
+    mMask = size - 1;
+    mRecords = (BFTraceRecord *)callocMustSucceed(size, sizeof(BFTraceRecord), "BFTraceRing");
+    epicsThreadGetName(epicsThreadGetIdSelf(), threadName, sizeof(threadName));
+}
+
+BFTraceRing::~BFTraceRing()
+{
+    free(mRecords);
+}
+
+/** Writes one record into the ring.  Only the owning thread writes, readers never block it.
+  * Once the ring is full the oldest records are overwritten.
+  */
+void BFTraceRing::record(BFTraceEvent_t event, BFTracePhase_t phase, epicsInt32 arg0, epicsInt64 arg1)
+{
+    size_t index = mHead;
+    BFTraceRecord *pRec = &mRecords[index & mMask];
+
+    epicsAtomicSetSizeT(&pRec->sequence, 0);
+    pRec->time = epicsMonotonicGet();
+    pRec->event = (epicsInt16)event;
+    pRec->phase = (epicsInt16)phase;
+    pRec->arg0 = arg0;
+    pRec->arg1 = arg1;
+    epicsAtomicSetSizeT(&pRec->sequence, index + 1);
+    epicsAtomicSetSizeT(&mHead, index + 1);
+}
+
+/** Appends the consistent records written at or after a monotonic time to a vector */
+void BFTraceRing::copyRecords(std::vector<BFTraceRecord> &records, epicsUInt64 since)
+{
+    size_t head = epicsAtomicGetSizeT(&mHead);
+    size_t count = mMask + 1;
+
+    if (count > head) count = head;
+    for (size_t index = head - count; index < head; index++) {
+        BFTraceRecord rec = mRecords[index & mMask];
+        // Skip records that are being written or have been overwritten since we read mHead
+        if (epicsAtomicGetSizeT(&mRecords[index & mMask].sequence) != index + 1) continue;
+        if (rec.sequence != index + 1) continue;
+        if (rec.time < since) continue;
+        // Reuse the sequence field to remember which ring the record came from
+        rec.sequence = threadIndex;
+        records.push_back(rec);
+    }
+}
+
+static bool compareTime(const BFTraceRecord &a, const BFTraceRecord &b)
+{
+    return a.time < b.time;
+}
+
+/** Constructor for the BFTracer class
+  * \param[in] recordsPerThread The number of records in the ring of each thread that records events.
+  */
+BFTracer::BFTracer(size_t recordsPerThread)
+    : mRecordsPerThread(recordsPerThread)
+{
+    mRingId = epicsThreadPrivateCreate();
+}
+
+/** Returns the ring of the calling thread, creating it on the first call from each thread */
+BFTraceRing *BFTracer::getRing()
+{
+    BFTraceRing *pRing = (BFTraceRing *)epicsThreadPrivateGet(mRingId);
+    if (!pRing) {
+        epicsGuard<epicsMutex> guard(mMutex);
+        pRing = new BFTraceRing(mRecordsPerThread, (int)mRings.size() + 1);
+        mRings.push_back(pRing);
+        epicsThreadPrivateSet(mRingId, pRing);
+    }
+    return pRing;
+}
+
+void BFTracer::record(BFTraceEvent_t event, BFTracePhase_t phase, epicsInt32 arg0, epicsInt64 arg1)
+{
+    getRing()->record(event, phase, arg0, arg1);
+}
+
+/** Decodes and prints the most recent records of all threads in time order.
+  * \param[in] fp File pointer to write output to
+  * \param[in] count Number of records to print.  0 prints all of them.
+  */
+void BFTracer::dump(FILE *fp, size_t count)
+{
+    std::vector<BFTraceRecord> records;
+    std::vector<const char *> names;
+
+    {
+        epicsGuard<epicsMutex> guard(mMutex);
+        names.push_back("");
+        for (size_t i=0; i<mRings.size(); i++) {
+            mRings[i]->copyRecords(records, 0);
+            names.push_back(mRings[i]->threadName);
+        }
+    }
+    std::sort(records.begin(), records.end(), compareTime);
+    if ((count == 0) || (count > records.size())) count = records.size();
+    fprintf(fp, "BFTracer: %lu records from %lu threads, showing last %lu\n",
+            (unsigned long)records.size(), (unsigned long)names.size()-1, (unsigned long)count);
+    if (count == 0) return;
+    epicsUInt64 startTime = records[records.size() - count].time;
+    for (size_t i=records.size() - count; i<records.size(); i++) {
+        BFTraceRecord &rec = records[i];
+        fprintf(fp, "%12.3f us %-24s %c %-16s %d %lld\n",
+                (rec.time - startTime)/1000., names[rec.sequence], (char)rec.phase,
+                eventName(rec.event), rec.arg0, (long long)rec.arg1);
+    }
+}
+
+/** Writes the records of all threads in Chrome trace event JSON format, which can be opened in Perfetto
+  * (https://ui.perfetto.dev) or chrome://tracing.
+  * \param[in] fileName Name of the output file
+  * \param[in] seconds Only records from the last seconds are written.  0 writes all of them.
+  * \return 0 on success, -1 if the file could not be opened.
+  */
+int BFTracer::writeChrome(const char *fileName, double seconds)
+{
+    std::vector<BFTraceRecord> records;
+    epicsUInt64 since = 0;
+    epicsUInt64 now = epicsMonotonicGet();
+
+    if ((seconds > 0) && (now > (epicsUInt64)(seconds*1e9))) since = now - (epicsUInt64)(seconds*1e9);
+    FILE *fp = fopen(fileName, "w");
+    if (!fp) return -1;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"ADBitFlow\"}}");
+    {
+        epicsGuard<epicsMutex> guard(mMutex);
+        for (size_t i=0; i<mRings.size(); i++) {
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    mRings[i]->threadIndex, mRings[i]->threadName);
+            mRings[i]->copyRecords(records, since);
+        }
+    }
+    std::sort(records.begin(), records.end(), compareTime);
+    for (size_t i=0; i<records.size(); i++) {
+        BFTraceRecord &rec = records[i];
+        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,",
+                eventName(rec.event), (char)rec.phase, (int)rec.sequence, rec.time/1000.);
+        if (rec.phase == BFTracePhaseInstant) fprintf(fp, "\"s\":\"t\",");
+        fprintf(fp, "\"args\":{\"arg0\":%d,\"arg1\":%lld}}", rec.arg0, (long long)rec.arg1);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return 0;
+}
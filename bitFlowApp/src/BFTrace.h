@@ -0,0 +1,97 @@
+// BFTrace.h
+// Per-frame trace recorder for the acquisition path.
+//
+// The BF_TRACE macros compile to nothing unless BF_FRAME_TRACE is defined (see Makefile).
+// When it is defined each call writes one fixed-size binary record into a lock-free ring buffer
+// owned by the calling thread.  Formatting is only done when the rings are dumped with the
+// ADBitFlowTraceDump or ADBitFlowTraceChrome iocsh commands.
+
+#ifndef BF_TRACE_H
+#define BF_TRACE_H
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+
+typedef enum {
+    BFTraceWaitFrame,
+    BFTraceGotFrame,
+    BFTraceHoldBuffer,
+    BFTraceSendMessage,
+    BFTraceDequeue,
+    BFTraceLock,
+    BFTraceFrameInfo,
+    BFTraceAllocArray,
+    BFTraceCopyData,
+    BFTraceAttributes,
+    BFTraceReleaseBuffer,
+    BFTraceCallbacks,
+    BFTraceStopCapture,
+    BFTraceNumEvents
+} BFTraceEvent_t;
+
+typedef enum {
+    BFTracePhaseInstant = 'i',
+    BFTracePhaseBegin   = 'B',
+    BFTracePhaseEnd     = 'E'
+} BFTracePhase_t;
+
+struct BFTraceRecord {
+    size_t sequence;        // Index of the record + 1, written last so the reader can detect torn records
+    epicsUInt64 time;       // epicsMonotonicGet() in ns
+    epicsInt16 event;
+    epicsInt16 phase;
+    epicsInt32 arg0;
+    epicsInt64 arg1;
+};
+
+/** Ring buffer of trace records written by a single thread */
+class BFTraceRing {
+public:
+    BFTraceRing(size_t numRecords, int threadIndex);
+    ~BFTraceRing();
+    void record(BFTraceEvent_t event, BFTracePhase_t phase, epicsInt32 arg0, epicsInt64 arg1);
+    void copyRecords(std::vector<BFTraceRecord> &records, epicsUInt64 since);
+    char threadName[32];
+    int threadIndex;
+
+private:
+    BFTraceRecord *mRecords;
+    size_t mMask;
+    size_t mHead;
+};
+
+/** Collection of the per-thread rings for one driver */
+class BFTracer {
+public:
+    BFTracer(size_t recordsPerThread);
+    void record(BFTraceEvent_t event, BFTracePhase_t phase, epicsInt32 arg0, epicsInt64 arg1);
+    void dump(FILE *fp, size_t count);
+    int writeChrome(const char *fileName, double seconds);
+
+private:
+    BFTraceRing *getRing();
+    size_t mRecordsPerThread;
+    epicsThreadPrivateId mRingId;
+    epicsMutex mMutex;
+    std::vector<BFTraceRing *> mRings;
+};
+
+#ifdef BF_FRAME_TRACE
+  #define BF_TRACE(pTracer, event, arg0, arg1) \
+      (pTracer)->record((event), BFTracePhaseInstant, (epicsInt32)(arg0), (epicsInt64)(arg1))
+  #define BF_TRACE_BEGIN(pTracer, event, arg0) \
+      (pTracer)->record((event), BFTracePhaseBegin, (epicsInt32)(arg0), 0)
+  #define BF_TRACE_END(pTracer, event, arg0) \
+      (pTracer)->record((event), BFTracePhaseEnd, (epicsInt32)(arg0), 0)
+#else
+  #define BF_TRACE(pTracer, event, arg0, arg1)
+  #define BF_TRACE_BEGIN(pTracer, event, arg0)
+  #define BF_TRACE_END(pTracer, event, arg0)
+#endif
+
+#endif